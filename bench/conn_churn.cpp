@@ -0,0 +1,109 @@
+// Connection churn against a running server: every request is made on a fresh
+// connection with "Connection: close", the way clients without keep-alive
+// behave. Reports connections/s and, when the server was built with
+// SERVER_COUNT_ALLOCATIONS, heap allocations per connection read from /__stats.
+//
+//     conn_churn <host> <port> <concurrency> <seconds>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/use_awaitable.hpp>
+
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+
+#include <boost/json.hpp>
+
+namespace beast = boost::beast;
+namespace http = beast::http;
+namespace net = boost::asio;
+
+using tcp = boost::asio::ip::tcp;
+using bench_clock = std::chrono::steady_clock;
+
+std::atomic<size_t> completed{0};
+
+net::awaitable<void> run_client(tcp::endpoint endpoint, bench_clock::time_point end) {
+    auto ex = co_await net::this_coro::executor;
+
+    http::request<http::empty_body> req{http::verb::get, "/status", 11};
+    req.set(http::field::host, "localhost");
+    req.keep_alive(false);
+
+    while (bench_clock::now() < end) {
+        tcp::socket socket(ex);
+        co_await socket.async_connect(endpoint, net::use_awaitable);
+        co_await http::async_write(socket, req, net::use_awaitable);
+
+        beast::flat_buffer buffer;
+        http::response<http::string_body> res;
+        co_await http::async_read(socket, buffer, res, net::use_awaitable);
+        ++completed;
+    }
+}
+
+boost::json::value fetch_stats(tcp::endpoint endpoint) {
+    net::io_context ioc;
+    tcp::socket socket(ioc);
+    socket.connect(endpoint);
+
+    http::request<http::empty_body> req{http::verb::get, "/__stats", 11};
+    req.set(http::field::host, "localhost");
+    req.keep_alive(false);
+    http::write(socket, req);
+
+    beast::flat_buffer buffer;
+    http::response<http::string_body> res;
+    http::read(socket, buffer, res);
+    return boost::json::parse(res.body());
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 5) {
+        std::cerr <<
+            "Usage: conn_churn <host> <port> <concurrency> <seconds>\n" <<
+            "Example:\n" <<
+            "    conn_churn 127.0.0.1 8080 32 10\n";
+        return EXIT_FAILURE;
+    }
+    tcp::endpoint const endpoint{net::ip::make_address(argv[1]), static_cast<unsigned short>(std::atoi(argv[2]))};
+    auto const concurrency = std::max(1, std::atoi(argv[3]));
+    auto const seconds = std::chrono::seconds(std::max(1, std::atoi(argv[4])));
+
+    auto const before = fetch_stats(endpoint);
+
+    net::io_context ioc;
+    auto const start = bench_clock::now();
+    for (int i = 0; i < concurrency; ++i) {
+        net::co_spawn(ioc, run_client(endpoint, start + seconds), net::detached);
+    }
+    ioc.run();
+    auto const elapsed = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+    auto const after = fetch_stats(endpoint);
+
+    std::cout << "connections/s: " << static_cast<double>(completed) / elapsed << "\n";
+
+    auto const& allocs_before = before.as_object().at("allocations");
+    auto const& allocs_after = after.as_object().at("allocations");
+    if (allocs_before.is_number() && allocs_after.is_number()) {
+        // One of the counted connections is the second /__stats request.
+        auto const connections = after.as_object().at("connections").to_number<double>() - before.as_object().at("connections").to_number<double>();
+        auto const allocations = allocs_after.to_number<double>() - allocs_before.to_number<double>();
+        std::cout << "allocations/connection: " << allocations / connections << "\n";
+    } else {
+        std::cout << "allocations/connection: n/a (server built without SERVER_COUNT_ALLOCATIONS)\n";
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,99 @@
+// Form parsing: form::fields against the istringstream/unordered_map parser
+// it replaced, on forms of growing size. Each iteration parses the whole body
+// and looks up three keys, as the /put and /post handlers do.
+//
+//     form_bench [min_seconds]
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+#include "form_parser.hpp"
+
+using bench_clock = std::chrono::steady_clock;
+
+// The previous parser, kept verbatim as the baseline.
+std::unordered_map<std::string, std::string> parse_form_data(const std::string& body) {
+    std::unordered_map<std::string, std::string> data;
+    std::istringstream stream(body);
+    std::string pair;
+
+    while (std::getline(stream, pair, '&')) {
+        size_t pos = pair.find('=');
+        if (pos != std::string::npos) {
+            std::string key = pair.substr(0, pos);
+            std::string value = pair.substr(pos + 1);
+            data[key] = value;
+        }
+    }
+    return data;
+}
+
+constexpr std::pair<std::string_view, std::string_view> expected[] = {
+    {"foo", "42"},
+    {"bar", "21"},
+    {"foo bar", "23"},
+};
+
+// n filler fields followed by the three the handlers look for.
+std::string make_form(size_t n, size_t value_size) {
+    std::string body;
+    for (size_t i = 0; i < n; ++i) {
+        body += "field_" + std::to_string(i) + "=" + std::string(value_size, 'x') + "%20y&";
+    }
+    body += "foo=42&bar=21&foo%20bar=23";
+    return body;
+}
+
+template <typename Parse>
+double ns_per_op(Parse&& parse, std::chrono::duration<double> min_time) {
+    size_t iterations = 16;
+    for (;;) {
+        size_t matched = 0;
+        auto const start = bench_clock::now();
+        for (size_t i = 0; i < iterations; ++i) {
+            matched += parse();
+        }
+        auto const elapsed = std::chrono::duration<double>(bench_clock::now() - start);
+        if (matched != iterations) {
+            std::cerr << "parser failed to match\n";
+            std::exit(EXIT_FAILURE);
+        }
+        if (elapsed >= min_time) {
+            return elapsed.count() * 1e9 / static_cast<double>(iterations);
+        }
+        iterations *= 2;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    auto const min_time = std::chrono::duration<double>(argc > 1 ? std::atof(argv[1]) : 0.5);
+
+    std::cout << std::right << std::setw(8) << "fields" << std::setw(12) << "bytes"
+              << std::setw(16) << "old ns/op" << std::setw(16) << "new ns/op" << std::setw(10) << "speedup" << "\n";
+
+    for (size_t const n : {0, 10, 100, 1000, 10000}) {
+        auto const body = make_form(n, 16);
+
+        // The old parser never decodes, so it is asked for the key as sent.
+        auto const old_ns = ns_per_op([&] {
+            auto form_data = parse_form_data(body);
+            return form_data["foo"] == "42" && form_data["bar"] == "21" && form_data["foo%20bar"] == "23";
+        }, min_time);
+
+        auto const new_ns = ns_per_op([&] {
+            return form::fields(body).contains_all(expected);
+        }, min_time);
+
+        std::cout << std::setw(8) << n + 3 << std::setw(12) << body.size() << std::fixed << std::setprecision(0)
+                  << std::setw(16) << old_ns << std::setw(16) << new_ns
+                  << std::setw(9) << std::setprecision(1) << old_ns / new_ns << "x\n";
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,197 @@
+// In-process benchmarks for the request-handling core: no sockets, no kernel.
+//
+// Each case is a canned raw request. "handler" cases run parse -> dispatch ->
+// serialize: the bytes go through http::request_parser, the parsed request
+// through handle_request, and the resulting message_generator is drained into
+// nothing. "session" cases run the whole do_session coroutine over an
+// in-memory stream, for the responses do_session streams itself.
+//
+// Reports ns/op and, when built with -DSERVER_COUNT_ALLOCATIONS=ON,
+// allocations/op.
+//
+//     handler_bench [filter] [min_seconds]
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/io_context.hpp>
+
+#include <boost/beast/_experimental/test/stream.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+
+#include "alloc_counter.hpp"
+#include "request_handler.hpp"
+#include "server_state.hpp"
+#include "session.hpp"
+
+namespace beast = boost::beast;
+namespace http = beast::http;
+namespace net = boost::asio;
+
+using bench_clock = std::chrono::steady_clock;
+
+struct bench_case {
+    char const* name;
+    bool session;
+    std::string raw;
+};
+
+std::string make_request(std::string_view start_line, std::string_view headers = {}, std::string_view body = {}) {
+    std::string raw(start_line);
+    raw += "\r\nHost: localhost\r\nUser-Agent: handler_bench\r\n";
+    raw += headers;
+    if ( ! body.empty()) {
+        raw += "Content-Length: " + std::to_string(body.size()) + "\r\n";
+    }
+    raw += "\r\n";
+    raw += body;
+    return raw;
+}
+
+std::vector<bench_case> make_cases() {
+    auto const form = "application/x-www-form-urlencoded";
+    auto const json = "application/json";
+    auto const content_type = [](std::string_view type) {
+        return "Content-Type: " + std::string(type) + "\r\n";
+    };
+
+    return {
+        {"GET /status", false, make_request("GET /status HTTP/1.1")},
+        {"GET /timestamp", false, make_request("GET /timestamp HTTP/1.1")},
+        {"GET /headers", false, make_request("GET /headers HTTP/1.1", "Accept: */*\r\nAccept-Encoding: gzip\r\n")},
+        {"GET /get", false, make_request("GET /get HTTP/1.1", "Accept: */*\r\nAccept-Encoding: gzip\r\n")},
+        {"POST /echo", false, make_request("POST /echo HTTP/1.1", content_type("text/plain"), "hello, world")},
+        {"GET /redirect-to", false, make_request("GET /redirect-to?url=%2Fstatus HTTP/1.1")},
+        {"GET /redirect/3", false, make_request("GET /redirect/3 HTTP/1.1")},
+        {"GET /image", false, make_request("GET /image HTTP/1.1")},
+        {"DELETE /delete", false, make_request("DELETE /delete HTTP/1.1", content_type(json), R"({"test-key":"test-value"})")},
+        {"PATCH /patch", false, make_request("PATCH /patch HTTP/1.1", content_type(json), R"({"test-key":"test-value"})")},
+        {"PUT /put form", false, make_request("PUT /put HTTP/1.1", content_type(form), "foo=42&bar=21&foo%20bar=23")},
+        {"PUT /put json", false, make_request("PUT /put HTTP/1.1", content_type(json), R"({"test-key":"test-value"})")},
+        {"POST /post form", false, make_request("POST /post HTTP/1.1", content_type(form), "foo=42&bar=21&foo%20bar=23")},
+        {"POST /post json", false, make_request("POST /post HTTP/1.1", content_type(json), R"({"test-key":"test-value"})")},
+        {"GET /cookies/set", false, make_request("GET /cookies/set?a=1&b=2 HTTP/1.1", "Cookie: sid=bench\r\n")},
+        {"GET /cookies", false, make_request("GET /cookies HTTP/1.1", "Cookie: sid=bench\r\n")},
+        {"GET /__stats", false, make_request("GET /__stats HTTP/1.1")},
+        {"GET /missing", false, make_request("GET /missing HTTP/1.1")},
+        {"session GET /status", true, make_request("GET /status HTTP/1.1", "Connection: close\r\n")},
+        {"session GET /bigfile 64k", true, make_request("GET /bigfile?total_size=65536&chunk_size=16384&delay_ms=0 HTTP/1.1", "Connection: close\r\n")},
+        {"session GET /bigfile 1m", true, make_request("GET /bigfile?total_size=1048576&chunk_size=262144&delay_ms=0 HTTP/1.1", "Connection: close\r\n")},
+    };
+}
+
+// Parse -> dispatch -> serialize. Returns the number of response bytes.
+size_t run_handler(std::string const& raw, server_state& state) {
+    beast::error_code ec;
+    http::request_parser<http::string_body> parser;
+    parser.eager(true);
+
+    net::const_buffer input = net::buffer(raw);
+    while ( ! parser.is_done()) {
+        auto const n = parser.put(input, ec);
+        if (ec) {
+            throw beast::system_error(ec);
+        }
+        input += n;
+    }
+
+    http::message_generator msg = handle_request(parser.release(), state);
+
+    size_t bytes = 0;
+    while ( ! msg.is_done()) {
+        auto const buffers = msg.prepare(ec);
+        if (ec) {
+            throw beast::system_error(ec);
+        }
+        auto const n = beast::buffer_bytes(buffers);
+        msg.consume(n);
+        bytes += n;
+    }
+    return bytes;
+}
+
+// A full session over an in-memory stream. Returns the number of response bytes.
+size_t run_session(std::string const& raw, server_state& state, net::io_context& ioc) {
+    beast::test::stream server(ioc);
+    beast::test::stream client(ioc);
+    server.connect(client);
+    server.append(raw);
+
+    net::co_spawn(ioc, do_session(std::move(server), state), [](std::exception_ptr e) {
+        if (e) {
+            std::rethrow_exception(e);
+        }
+    });
+    ioc.restart();
+    ioc.run();
+
+    auto const bytes = client.buffer().size();
+    client.buffer().consume(bytes);
+    return bytes;
+}
+
+int main(int argc, char* argv[]) {
+    std::string_view const filter = argc > 1 ? argv[1] : "";
+    auto const min_time = std::chrono::duration<double>(argc > 2 ? std::atof(argv[2]) : 0.5);
+
+    net::io_context ioc;
+
+    server_options options;
+    options.log_requests = false;
+    server_state state{std::move(options), ioc.get_executor(), 1};
+
+    std::cout << std::left << std::setw(28) << "case"
+              << std::right << std::setw(12) << "ns/op"
+              << std::setw(12) << "allocs/op"
+              << std::setw(12) << "bytes/op" << "\n";
+
+    for (auto const& c : make_cases()) {
+        if ( ! filter.empty() && std::string_view(c.name).find(filter) == std::string_view::npos) {
+            continue;
+        }
+        auto const run_once = [&] {
+            return c.session ? run_session(c.raw, state, ioc) : run_handler(c.raw, state);
+        };
+
+        // Warm up caches, pools and the cookie jar entry, then double the batch
+        // until it runs long enough to time.
+        size_t bytes = 0;
+        for (int i = 0; i < 100; ++i) {
+            bytes = run_once();
+        }
+
+        size_t iterations = 100;
+        for (;;) {
+            auto const allocs_before = allocations();
+            auto const start = bench_clock::now();
+            for (size_t i = 0; i < iterations; ++i) {
+                run_once();
+            }
+            auto const elapsed = std::chrono::duration<double>(bench_clock::now() - start);
+            auto const allocs_after = allocations();
+
+            if (elapsed < min_time) {
+                iterations *= 2;
+                continue;
+            }
+
+            std::cout << std::left << std::setw(28) << c.name << std::right << std::fixed
+                      << std::setw(12) << std::setprecision(0) << elapsed.count() * 1e9 / static_cast<double>(iterations);
+            if (allocs_before && allocs_after) {
+                std::cout << std::setw(12) << std::setprecision(1) << static_cast<double>(*allocs_after - *allocs_before) / static_cast<double>(iterations);
+            } else {
+                std::cout << std::setw(12) << "n/a";
+            }
+            std::cout << std::setw(12) << bytes << "\n";
+            break;
+        }
+    }
+    return EXIT_SUCCESS;
+}
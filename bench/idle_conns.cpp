@@ -0,0 +1,158 @@
+// Idle keep-alive connections against a running server: opens n connections,
+// makes one request on each so every session has been through a full
+// request, then leaves them all open and idle. Reports the server's resident
+// memory per connection, from the rss_bytes /__stats reports.
+//
+//     idle_conns <host> <port> <connections> [hold seconds]
+//
+// One client address has about 28k ephemeral ports, so against a loopback
+// server the connections are spread over source addresses 127.0.0.2,
+// 127.0.0.3, ... Both sides need a file descriptor limit above n; the
+// benchmark raises its own soft limit to the hard limit.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/use_awaitable.hpp>
+
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+
+#include <boost/json.hpp>
+
+namespace beast = boost::beast;
+namespace http = beast::http;
+namespace net = boost::asio;
+
+using tcp = boost::asio::ip::tcp;
+
+constexpr size_t connections_per_source = 20000;
+
+std::atomic<size_t> opened{0};
+std::atomic<size_t> failed{0};
+
+net::ip::address source_address(size_t index) {
+    return net::ip::address_v4((127u << 24) + 2 + static_cast<std::uint32_t>(index / connections_per_source));
+}
+
+net::awaitable<void> open_connections(tcp::endpoint endpoint, size_t first, size_t count, size_t stride, std::vector<tcp::socket>& sockets) {
+    auto ex = co_await net::this_coro::executor;
+    bool const loopback = endpoint.address().is_loopback() && endpoint.address().is_v4();
+
+    http::request<http::empty_body> req{http::verb::get, "/status", 11};
+    req.set(http::field::host, "localhost");
+    req.keep_alive(true);
+
+    for (size_t i = first; i < count; i += stride) {
+        try {
+            tcp::socket socket(ex);
+            if (loopback) {
+                socket.open(tcp::v4());
+                socket.bind(tcp::endpoint(source_address(i), 0));
+            }
+            co_await socket.async_connect(endpoint, net::use_awaitable);
+            co_await http::async_write(socket, req, net::use_awaitable);
+
+            beast::flat_buffer buffer;
+            http::response<http::string_body> res;
+            co_await http::async_read(socket, buffer, res, net::use_awaitable);
+
+            sockets[i] = std::move(socket);
+            ++opened;
+        } catch (std::exception const& e) {
+            if (failed++ == 0) {
+                std::cerr << "connection " << i << ": " << e.what() << "\n";
+            }
+        }
+    }
+}
+
+boost::json::value fetch_stats(tcp::endpoint endpoint) {
+    net::io_context ioc;
+    tcp::socket socket(ioc);
+    socket.connect(endpoint);
+
+    http::request<http::empty_body> req{http::verb::get, "/__stats", 11};
+    req.set(http::field::host, "localhost");
+    req.keep_alive(false);
+    http::write(socket, req);
+
+    beast::flat_buffer buffer;
+    http::response<http::string_body> res;
+    http::read(socket, buffer, res);
+    return boost::json::parse(res.body());
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 4 && argc != 5) {
+        std::cerr <<
+            "Usage: idle_conns <host> <port> <connections> [hold seconds]\n" <<
+            "Example:\n" <<
+            "    idle_conns 127.0.0.1 8080 100000\n";
+        return EXIT_FAILURE;
+    }
+    tcp::endpoint const endpoint{net::ip::make_address(argv[1]), static_cast<unsigned short>(std::atoi(argv[2]))};
+    auto const n = static_cast<size_t>(std::max(1, std::atoi(argv[3])));
+    auto const hold = std::chrono::seconds(argc == 5 ? std::max(0, std::atoi(argv[4])) : 0);
+
+    rlimit limit{};
+    if (::getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        limit.rlim_cur = limit.rlim_max;
+        ::setrlimit(RLIMIT_NOFILE, &limit);
+        if (limit.rlim_cur < n + 16) {
+            std::cerr << "warning: file descriptor limit " << limit.rlim_cur << " is below " << n << " connections\n";
+        }
+    }
+
+    auto const before = fetch_stats(endpoint);
+    auto const* rss = before.is_object() ? before.as_object().if_contains("rss_bytes") : nullptr;
+    if ( ! rss || ! rss->is_number()) {
+        std::cerr << "The server does not report rss_bytes in /__stats\n";
+        return EXIT_FAILURE;
+    }
+
+    // A bounded number of connects in flight, so the listen backlog does
+    // not overflow.
+    constexpr size_t openers = 256;
+    std::vector<tcp::socket> sockets;
+    net::io_context ioc;
+    sockets.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+        sockets.emplace_back(ioc);
+    }
+    auto const start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < std::min(openers, n); ++i) {
+        net::co_spawn(ioc, open_connections(endpoint, i, n, openers, sockets), net::detached);
+    }
+    ioc.run();
+    auto const elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // Let the server return what the connection burst borrowed.
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    auto const after = fetch_stats(endpoint);
+
+    auto const rss_before = rss->to_number<double>();
+    auto const rss_after = after.as_object().at("rss_bytes").to_number<double>();
+    std::cout << "connections: " << opened << " open, " << failed << " failed, in " << elapsed << " s\n";
+    std::cout << "server rss: " << rss_before / (1 << 20) << " MiB -> " << rss_after / (1 << 20) << " MiB\n";
+    if (opened > 0) {
+        std::cout << "rss/connection: " << (rss_after - rss_before) / static_cast<double>(opened) << " bytes\n";
+    }
+
+    std::this_thread::sleep_for(hold);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,37 @@
+#!/usr/bin/env bash
+# Builds the server with the epoll and the io_uring backend and runs io_bench
+# against each, one after the other.
+#
+#     bench/io_backends.sh [connections] [seconds]
+#
+# Extra configure arguments (e.g. the conan toolchain) go in CMAKE_ARGS. The
+# builds go under $TMPDIR (default /tmp), out of the source tree.
+
+set -euo pipefail
+
+connections=${1:-64}
+seconds=${2:-10}
+port=18080
+root=$(cd "$(dirname "$0")/.." && pwd)
+
+for backend in epoll io_uring; do
+    build="${TMPDIR:-/tmp}/server_bench_$backend"
+    uring=OFF
+    if [ "$backend" = io_uring ]; then
+        uring=ON
+    fi
+    cmake -S "$root" -B "$build" -DCMAKE_BUILD_TYPE=Release \
+        -DSERVER_BUILD_BENCHMARKS=ON -DSERVER_USE_IO_URING=$uring ${CMAKE_ARGS:-} > /dev/null
+    cmake --build "$build" -j"$(nproc)" > /dev/null
+
+    "$build/server" 127.0.0.1 $port 4 > /dev/null &
+    server=$!
+    sleep 1
+
+    echo "== $backend"
+    "$build/io_bench" 127.0.0.1 $port small "$connections" "$seconds"
+    "$build/io_bench" 127.0.0.1 $port bulk "$connections" "$seconds"
+
+    kill $server
+    wait $server 2> /dev/null || true
+done
@@ -0,0 +1,218 @@
+// Load generator for comparing I/O backends against a running server.
+//
+//     io_bench <host> <port> small <connections> <seconds>
+//         keep-alive GET /status on every connection, reports requests/s and
+//         p50/p99 latency
+//
+//     io_bench <host> <port> bulk <connections> <seconds>
+//         repeated /bigfile downloads with no delay, reports MB/s
+//
+//     io_bench <host> <port> paced <connections> <seconds>
+//         repeated /bigfile downloads with a 10 ms delay between 64 KiB
+//         chunks; reports how far the gaps between chunk arrivals stray from
+//         the delay, i.e. how faithfully the server's pacing reaches the client
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/redirect_error.hpp>
+#include <boost/asio/use_awaitable.hpp>
+
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+
+namespace beast = boost::beast;
+namespace http = beast::http;
+namespace net = boost::asio;
+
+using tcp = boost::asio::ip::tcp;
+using bench_clock = std::chrono::steady_clock;
+
+std::atomic<size_t> requests{0};
+std::atomic<size_t> bytes{0};
+
+// Per-request latencies (small) or chunk gap errors (paced), in microseconds.
+std::mutex samples_mutex;
+std::vector<double> samples;
+
+void add_samples(std::vector<double> const& local) {
+    std::lock_guard lock(samples_mutex);
+    samples.insert(samples.end(), local.begin(), local.end());
+}
+
+double percentile(std::vector<double>& v, double p) {
+    if (v.empty()) {
+        return 0;
+    }
+    auto const k = static_cast<size_t>(p * static_cast<double>(v.size() - 1));
+    std::nth_element(v.begin(), v.begin() + static_cast<std::ptrdiff_t>(k), v.end());
+    return v[k];
+}
+
+net::awaitable<void> run_small(tcp::endpoint endpoint, bench_clock::time_point end) {
+    tcp::socket socket(co_await net::this_coro::executor);
+    co_await socket.async_connect(endpoint, net::use_awaitable);
+    socket.set_option(tcp::no_delay(true));
+
+    beast::flat_buffer buffer;
+    http::request<http::empty_body> req{http::verb::get, "/status", 11};
+    req.set(http::field::host, "localhost");
+
+    std::vector<double> latencies;
+    while (bench_clock::now() < end) {
+        auto const sent = bench_clock::now();
+        co_await http::async_write(socket, req, net::use_awaitable);
+        http::response<http::string_body> res;
+        co_await http::async_read(socket, buffer, res, net::use_awaitable);
+        latencies.push_back(std::chrono::duration<double, std::micro>(bench_clock::now() - sent).count());
+        ++requests;
+    }
+    add_samples(latencies);
+}
+
+net::awaitable<void> run_bulk(tcp::endpoint endpoint, bench_clock::time_point end) {
+    tcp::socket socket(co_await net::this_coro::executor);
+    co_await socket.async_connect(endpoint, net::use_awaitable);
+
+    beast::flat_buffer buffer;
+    http::request<http::empty_body> req{http::verb::get, "/bigfile?total_size=67108864&chunk_size=262144&delay_ms=0", 11};
+    req.set(http::field::host, "localhost");
+    std::vector<char> sink(1 << 20);
+
+    while (bench_clock::now() < end) {
+        co_await http::async_write(socket, req, net::use_awaitable);
+
+        http::response_parser<http::buffer_body> parser;
+        parser.body_limit(boost::none);
+        co_await http::async_read_header(socket, buffer, parser, net::use_awaitable);
+
+        while ( ! parser.is_done()) {
+            parser.get().body().data = sink.data();
+            parser.get().body().size = sink.size();
+            beast::error_code ec;
+            co_await http::async_read(socket, buffer, parser, net::redirect_error(net::use_awaitable, ec));
+            if (ec && ec != http::error::need_buffer) {
+                throw beast::system_error(ec);
+            }
+            bytes += sink.size() - parser.get().body().size;
+        }
+        ++requests;
+    }
+}
+
+net::awaitable<void> run_paced(tcp::endpoint endpoint, bench_clock::time_point end) {
+    constexpr size_t chunk = 64 * 1024;
+    constexpr auto delay = std::chrono::milliseconds(10);
+
+    tcp::socket socket(co_await net::this_coro::executor);
+    co_await socket.async_connect(endpoint, net::use_awaitable);
+
+    beast::flat_buffer buffer;
+    http::request<http::empty_body> req{http::verb::get, "/bigfile?total_size=1048576&chunk_size=65536&delay_ms=10", 11};
+    req.set(http::field::host, "localhost");
+    std::vector<char> sink(1 << 20);
+    std::vector<double> errors;
+
+    while (bench_clock::now() < end) {
+        co_await http::async_write(socket, req, net::use_awaitable);
+
+        http::response_parser<http::buffer_body> parser;
+        parser.body_limit(boost::none);
+        co_await http::async_read_header(socket, buffer, parser, net::use_awaitable);
+
+        // The time each chunk's first byte arrived; from the second chunk on,
+        // the gap to the previous one should be the delay. async_read_some,
+        // since async_read would keep reading until the sink is full and see
+        // every chunk arrive at once.
+        size_t received = 0;
+        bench_clock::time_point last{};
+        while ( ! parser.is_done()) {
+            parser.get().body().data = sink.data();
+            parser.get().body().size = sink.size();
+            beast::error_code ec;
+            co_await http::async_read_some(socket, buffer, parser, net::redirect_error(net::use_awaitable, ec));
+            if (ec && ec != http::error::need_buffer) {
+                throw beast::system_error(ec);
+            }
+            auto const now = bench_clock::now();
+            auto const n = sink.size() - parser.get().body().size;
+            for (auto boundary = (received + chunk - 1) / chunk * chunk; boundary < received + n; boundary += chunk) {
+                if (boundary > 0) {
+                    errors.push_back(std::abs(std::chrono::duration<double, std::micro>(now - last - delay).count()));
+                }
+                last = now;
+            }
+            received += n;
+            bytes += n;
+        }
+        ++requests;
+    }
+    add_samples(errors);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 6) {
+        std::cerr <<
+            "Usage: io_bench <host> <port> <small|bulk|paced> <connections> <seconds>\n" <<
+            "Example:\n" <<
+            "    io_bench 127.0.0.1 8080 small 64 10\n";
+        return EXIT_FAILURE;
+    }
+    tcp::endpoint const endpoint{net::ip::make_address(argv[1]), static_cast<unsigned short>(std::atoi(argv[2]))};
+    std::string const mode = argv[3];
+    auto const connections = std::max(1, std::atoi(argv[4]));
+    auto const seconds = std::chrono::seconds(std::max(1, std::atoi(argv[5])));
+
+    net::io_context ioc;
+    auto const start = bench_clock::now();
+    auto const end = start + seconds;
+
+    for (int i = 0; i < connections; ++i) {
+        if (mode == "bulk") {
+            net::co_spawn(ioc, run_bulk(endpoint, end), net::detached);
+        } else if (mode == "paced") {
+            net::co_spawn(ioc, run_paced(endpoint, end), net::detached);
+        } else {
+            net::co_spawn(ioc, run_small(endpoint, end), net::detached);
+        }
+    }
+
+    auto const threads = std::max(1u, std::thread::hardware_concurrency() / 2);
+    std::vector<std::thread> v;
+    for (unsigned i = 1; i < threads; ++i) {
+        v.emplace_back([&ioc] { ioc.run(); });
+    }
+    ioc.run();
+    for (auto& t : v) {
+        t.join();
+    }
+
+    auto const elapsed = std::chrono::duration<double>(bench_clock::now() - start).count();
+    if (mode == "bulk") {
+        std::cout << "bulk: " << static_cast<double>(bytes) / elapsed / 1e6 << " MB/s ("
+                  << requests << " downloads)\n";
+    } else if (mode == "paced") {
+        auto const p50 = percentile(samples, 0.5);
+        auto const p99 = percentile(samples, 0.99);
+        std::cout << "paced: chunk gap error p50 " << p50 << " us, p99 " << p99 << " us ("
+                  << requests << " downloads)\n";
+    } else {
+        auto const p50 = percentile(samples, 0.5);
+        auto const p99 = percentile(samples, 0.99);
+        std::cout << "small: " << static_cast<double>(requests) / elapsed << " requests/s, latency p50 "
+                  << p50 << " us, p99 " << p99 << " us\n";
+    }
+    return EXIT_SUCCESS;
+}
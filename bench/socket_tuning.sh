@@ -0,0 +1,31 @@
+#!/usr/bin/env bash
+# Runs io_bench against the server with per-route socket tuning off and on:
+# small-request rate and latency, bulk throughput, and pacing accuracy of
+# delayed /bigfile downloads.
+#
+#     bench/socket_tuning.sh <build dir> [connections] [seconds]
+#
+# The build needs -DSERVER_BUILD_BENCHMARKS=ON. Loopback hides most of what
+# the send buffer does; for the paced case, shape the link first, e.g.
+#     tc qdisc add dev lo root netem rate 100mbit delay 5ms
+
+set -euo pipefail
+
+build=${1:?usage: socket_tuning.sh <build dir> [connections] [seconds]}
+connections=${2:-64}
+seconds=${3:-10}
+port=18081
+
+for tuning in 0 1; do
+    "$build/server" 127.0.0.1 $port 4 --log-requests=0 --socket-tuning=$tuning > /dev/null &
+    server=$!
+    sleep 1
+
+    echo "== socket-tuning=$tuning"
+    "$build/io_bench" 127.0.0.1 $port small "$connections" "$seconds"
+    "$build/io_bench" 127.0.0.1 $port bulk "$connections" "$seconds"
+    "$build/io_bench" 127.0.0.1 $port paced "$connections" "$seconds"
+
+    kill $server
+    wait $server 2> /dev/null || true
+done
@@ -0,0 +1,116 @@
+// Compares the timing wheel against plain steady_timer with many pending
+// timers: cost to schedule N waits, to cancel half of them, and to let the
+// rest expire. Expiry is reported as CPU time spent in io_context::run, since
+// wall time is dominated by the longest delay.
+//
+//     timer_bench [max_delay_ms]
+
+#include <chrono>
+#include <ctime>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+#include "timing_wheel.hpp"
+
+namespace net = boost::asio;
+
+using bench_clock = std::chrono::steady_clock;
+
+struct result {
+    double schedule_ns;
+    double cancel_ns;
+    double expire_cpu_ms;
+};
+
+double ns_per_op(bench_clock::duration d, size_t n) {
+    return std::chrono::duration<double, std::nano>(d).count() / static_cast<double>(n);
+}
+
+std::vector<std::chrono::milliseconds> make_delays(size_t n, unsigned max_delay_ms) {
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<unsigned> distrib(1, max_delay_ms);
+    std::vector<std::chrono::milliseconds> delays(n);
+    for (auto& d : delays) {
+        d = std::chrono::milliseconds(distrib(gen));
+    }
+    return delays;
+}
+
+result run_steady_timer(std::vector<std::chrono::milliseconds> const& delays) {
+    net::io_context ioc{1};
+    std::vector<std::unique_ptr<net::steady_timer>> timers;
+    timers.reserve(delays.size());
+    size_t fired = 0;
+
+    auto const t0 = bench_clock::now();
+    for (auto d : delays) {
+        timers.push_back(std::make_unique<net::steady_timer>(ioc, d));
+        timers.back()->async_wait([&fired](boost::system::error_code ec) {
+            if ( ! ec) {
+                ++fired;
+            }
+        });
+    }
+    auto const t1 = bench_clock::now();
+    for (size_t i = 0; i < timers.size(); i += 2) {
+        timers[i]->cancel();
+    }
+    auto const t2 = bench_clock::now();
+    auto const c0 = std::clock();
+    ioc.run();
+    auto const c1 = std::clock();
+
+    return {ns_per_op(t1 - t0, delays.size()), ns_per_op(t2 - t1, delays.size() / 2),
+            1000.0 * static_cast<double>(c1 - c0) / CLOCKS_PER_SEC};
+}
+
+result run_timing_wheel(std::vector<std::chrono::milliseconds> const& delays) {
+    net::io_context ioc{1};
+    timing_wheel_service service(ioc.get_executor(), 1);
+    std::vector<std::unique_ptr<wheel_timer>> timers;
+    timers.reserve(delays.size());
+    size_t fired = 0;
+
+    auto const t0 = bench_clock::now();
+    for (auto d : delays) {
+        timers.push_back(std::make_unique<wheel_timer>(service));
+        timers.back()->async_wait(d, [&fired](boost::system::error_code ec) {
+            if ( ! ec) {
+                ++fired;
+            }
+        });
+    }
+    auto const t1 = bench_clock::now();
+    for (size_t i = 0; i < timers.size(); i += 2) {
+        timers[i]->cancel();
+    }
+    auto const t2 = bench_clock::now();
+    auto const c0 = std::clock();
+    ioc.run();
+    auto const c1 = std::clock();
+
+    return {ns_per_op(t1 - t0, delays.size()), ns_per_op(t2 - t1, delays.size() / 2),
+            1000.0 * static_cast<double>(c1 - c0) / CLOCKS_PER_SEC};
+}
+
+int main(int argc, char* argv[]) {
+    unsigned const max_delay_ms = argc > 1 ? static_cast<unsigned>(std::atoi(argv[1])) : 2000;
+
+    std::cout << "timers      impl          schedule ns/op   cancel ns/op   expire cpu ms\n";
+    for (size_t n : {10000, 100000, 1000000}) {
+        auto const delays = make_delays(n, max_delay_ms);
+        for (auto [name, run] : {std::pair{"steady_timer", &run_steady_timer},
+                                 std::pair{"timing_wheel", &run_timing_wheel}}) {
+            auto const r = run(delays);
+            std::cout << n << "\t    " << name << "\t  " << r.schedule_ns << "\t\t   "
+                      << r.cancel_ns << "\t  " << r.expire_cpu_ms << "\n";
+        }
+    }
+    return EXIT_SUCCESS;
+}
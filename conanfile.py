@@ -7,11 +7,15 @@ class serverRecipe(ConanFile):
     version = "1.0.0"
     package_type = "application"
     settings = "os", "compiler", "build_type", "arch"
+    options = {"io_uring": [True, False]}
+    default_options = {"io_uring": False}
 
-    exports_sources = "CMakeLists.txt", "src/*"
+    exports_sources = "CMakeLists.txt", "src/*", "bench/*"
 
     def requirements(self):
         self.requires("boost/1.82.0", transitive_headers=True, transitive_libs=True)
+        if self.options.io_uring:
+            self.requires("liburing/2.4")
 
     def layout(self):
         cmake_layout(self)
@@ -20,6 +24,7 @@ class serverRecipe(ConanFile):
         deps = CMakeDeps(self)
         deps.generate()
         tc = CMakeToolchain(self)
+        tc.variables["SERVER_USE_IO_URING"] = bool(self.options.io_uring)
         tc.generate()
 
     def build(self):
@@ -0,0 +1,205 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/beast/http.hpp>
+#include <boost/beast/version.hpp>
+
+#include "thread_slot.hpp"
+
+// Admission control: bounds the number of requests in flight so that the ones
+// we admit keep a bounded latency, and answers the rest with a cheap 503.
+//
+// The limit is adapted AIMD-style from the event loop's lag, the time a ready
+// handler waits before a thread runs it, which is the queueing delay every
+// request on the loop pays. As in CoDel, a short burst is fine and only a
+// standing queue counts: if even the smallest lag seen over a whole interval
+// is above target, the limit is cut by a quarter. Otherwise, if the limit was
+// reached during the interval, it grows by one request per thread.
+//
+// In-flight requests are counted per thread. A thread checks only its own
+// counter against its share of the limit, and sums all of them only when it
+// is over its share.
+
+struct admission_options {
+    std::chrono::milliseconds target_lag{0};        // 0 disables admission control
+    std::chrono::milliseconds interval{100};
+    std::size_t max_in_flight = 10000;
+    std::size_t min_in_flight = 4;
+    std::chrono::seconds retry_after{1};
+};
+
+class admission_controller {
+    struct alignas(64) shard {
+        std::atomic<std::size_t> in_flight{0};
+    };
+
+public:
+    // Held for the duration of one admitted request.
+    class ticket {
+    public:
+        ticket() = default;
+
+        ticket(ticket&& other) noexcept
+            : shard_(std::exchange(other.shard_, nullptr))
+        {}
+
+        ticket& operator=(ticket&& other) noexcept {
+            if (this != &other) {
+                release();
+                shard_ = std::exchange(other.shard_, nullptr);
+            }
+            return *this;
+        }
+
+        ~ticket() {
+            release();
+        }
+
+        explicit operator bool() const {
+            return shard_ != nullptr;
+        }
+
+    private:
+        friend class admission_controller;
+
+        explicit ticket(shard* s)
+            : shard_(s)
+        {}
+
+        void release() {
+            if (shard_) {
+                shard_->in_flight.fetch_sub(1, std::memory_order_relaxed);
+                shard_ = nullptr;
+            }
+        }
+
+        shard* shard_ = nullptr;
+    };
+
+    admission_controller(admission_options options, std::size_t threads)
+        : options_(options)
+        , shards_(std::max<std::size_t>(1, threads))
+        , limit_(options.max_in_flight)
+        , rejection_keep_alive_(make_rejection(true))
+        , rejection_close_(make_rejection(false))
+    {}
+
+    bool enabled() const {
+        return options_.target_lag.count() > 0;
+    }
+
+    admission_options const& options() const {
+        return options_;
+    }
+
+    // An empty ticket means the request should be shed.
+    ticket try_admit() {
+        auto& s = local();
+        if ( ! enabled()) {
+            s.in_flight.fetch_add(1, std::memory_order_relaxed);
+            return ticket(&s);
+        }
+
+        auto const limit = limit_.load(std::memory_order_relaxed);
+        auto const share = std::max<std::size_t>(1, limit / shards_.size());
+        if (s.in_flight.load(std::memory_order_relaxed) >= share && in_flight() >= limit) {
+            saturated_.store(true, std::memory_order_relaxed);
+            shed_.fetch_add(1, std::memory_order_relaxed);
+            return ticket();
+        }
+        s.in_flight.fetch_add(1, std::memory_order_relaxed);
+        return ticket(&s);
+    }
+
+    // Pre-serialized "503 Service Unavailable" with Retry-After.
+    std::string const& rejection(bool keep_alive) const {
+        return keep_alive ? rejection_keep_alive_ : rejection_close_;
+    }
+
+    // Feeds one lag measurement; called from a single probe coroutine.
+    void record_lag(std::chrono::steady_clock::duration lag, std::chrono::steady_clock::time_point now) {
+        last_lag_.store(std::chrono::duration_cast<std::chrono::microseconds>(lag).count(), std::memory_order_relaxed);
+        if (interval_start_ == std::chrono::steady_clock::time_point{}) {
+            interval_start_ = now;
+            min_lag_ = lag;
+        }
+        min_lag_ = std::min(min_lag_, lag);
+        if (now - interval_start_ < options_.interval) {
+            return;
+        }
+
+        auto limit = limit_.load(std::memory_order_relaxed);
+        if (min_lag_ > options_.target_lag) {
+            limit = std::max(options_.min_in_flight, limit - limit / 4);
+        } else if (saturated_.exchange(false, std::memory_order_relaxed)) {
+            limit = std::min(options_.max_in_flight, limit + shards_.size());
+        }
+        limit_.store(limit, std::memory_order_relaxed);
+
+        interval_start_ = now;
+        min_lag_ = lag;
+    }
+
+    std::size_t in_flight() const {
+        std::size_t n = 0;
+        for (auto const& s : shards_) {
+            n += s.in_flight.load(std::memory_order_relaxed);
+        }
+        return n;
+    }
+
+    std::size_t limit() const {
+        return limit_.load(std::memory_order_relaxed);
+    }
+
+    std::uint64_t shed() const {
+        return shed_.load(std::memory_order_relaxed);
+    }
+
+    std::chrono::microseconds last_lag() const {
+        return std::chrono::microseconds(last_lag_.load(std::memory_order_relaxed));
+    }
+
+private:
+    shard& local() {
+        return shards_[thread_slot::index(shards_.size())];
+    }
+
+    std::string make_rejection(bool keep_alive) const {
+        namespace http = boost::beast::http;
+        http::response<http::string_body> res{http::status::service_unavailable, 11};
+        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+        res.set(http::field::content_type, "text/plain");
+        res.set(http::field::retry_after, std::to_string(options_.retry_after.count()));
+        res.keep_alive(keep_alive);
+        res.body() = "Server overloaded, retry later.";
+        res.prepare_payload();
+
+        std::ostringstream out;
+        out << res;
+        return std::move(out).str();
+    }
+
+    admission_options options_;
+    std::vector<shard> shards_;
+    std::atomic<std::size_t> limit_;
+    std::atomic<bool> saturated_{false};
+    std::atomic<std::uint64_t> shed_{0};
+    std::atomic<std::int64_t> last_lag_{0};
+
+    // Only touched by record_lag.
+    std::chrono::steady_clock::time_point interval_start_{};
+    std::chrono::steady_clock::duration min_lag_{};
+
+    std::string rejection_keep_alive_;
+    std::string rejection_close_;
+};
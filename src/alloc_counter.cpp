@@ -0,0 +1,45 @@
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include "alloc_counter.hpp"
+
+// Replaces the global allocation functions to count calls. Only linked in
+// measurement builds (SERVER_COUNT_ALLOCATIONS): the shared counter is cheap
+// but not free.
+
+namespace {
+std::atomic<std::uint64_t> allocations_{0};
+}
+
+std::uint64_t allocation_count() noexcept {
+    return allocations_.load(std::memory_order_relaxed);
+}
+
+void* operator new(std::size_t size) {
+    allocations_.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size == 0 ? 1 : size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+    return ::operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept {
+    std::free(p);
+}
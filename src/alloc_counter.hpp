@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+
+// Number of global operator new calls since startup, when the server is built
+// with SERVER_COUNT_ALLOCATIONS; otherwise nothing is counted.
+#if defined(SERVER_COUNT_ALLOCATIONS)
+std::uint64_t allocation_count() noexcept;
+#endif
+
+inline std::optional<std::uint64_t> allocations() noexcept {
+#if defined(SERVER_COUNT_ALLOCATIONS)
+    return allocation_count();
+#else
+    return std::nullopt;
+#endif
+}
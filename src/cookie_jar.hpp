@@ -0,0 +1,231 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "virtual_clock.hpp"
+
+// Server-side cookie state per client session, so /cookies reflects what the
+// client was actually told to store.
+//
+// Sessions are spread over independently locked shards; a request only ever
+// touches the shard its session id hashes to, so I/O threads do not contend on
+// a global lock. Each shard is bounded (least recently used session is evicted
+// first) and owns a hashed timing wheel with one-second slots that drops
+// cookies once their Max-Age/Expires passes. A cookie holds on to its wheel
+// entry, which goes when the cookie is overwritten, erased or evicted with its
+// session, so the wheel never holds more entries than there are cookies.
+// Lookups also filter expired cookies, so a cookie is never visible past its
+// deadline even between ticks.
+// Max-Age counts virtual_clock seconds. An Expires date passes in real time
+// for the client, so the handler converts it before it gets here.
+
+class cookie_jar {
+public:
+    using clock = virtual_clock;
+    using cookie_list = std::vector<std::pair<std::string, std::string>>;
+
+    static constexpr std::size_t max_cookies_per_session = 64;
+
+    explicit cookie_jar(std::size_t max_sessions, std::size_t shard_count = 64)
+        : shards_(std::max<std::size_t>(1, shard_count))
+        , max_sessions_per_shard_(std::max<std::size_t>(1, (max_sessions + shards_.size() - 1) / shards_.size()))
+        , start_(clock::now())
+    {}
+
+    static std::string new_session_id() {
+        thread_local std::mt19937_64 gen{std::random_device{}()};
+        std::ostringstream out;
+        out << std::hex << std::setfill('0') << std::setw(16) << gen() << std::setw(16) << gen();
+        return std::move(out).str();
+    }
+
+    // A `max_age` of zero or less deletes the cookie, as a browser would.
+    // Returns false if the cookie was not stored: a new one in a session that
+    // already holds max_cookies_per_session.
+    bool set(std::string_view session_id, std::string_view name, std::string_view value,
+             std::optional<std::chrono::seconds> max_age = std::nullopt) {
+        if (max_age && max_age->count() <= 0) {
+            erase(session_id, name);
+            return true;
+        }
+
+        auto& s = shard_for(session_id);
+        std::lock_guard lock(s.mutex);
+
+        auto& sess = s.touch(session_id, max_sessions_per_shard_);
+        auto it = sess.cookies.find(std::string(name));
+        if (it == sess.cookies.end()) {
+            if (sess.cookies.size() >= max_cookies_per_session) {
+                return false;
+            }
+            it = sess.cookies.emplace(std::string(name), cookie{}).first;
+        }
+        it->second.value = value;
+        s.unschedule(it->second);
+
+        if (max_age) {
+            auto const expires = now_tick() + static_cast<std::uint64_t>(max_age->count());
+            auto& slot = s.wheel[expires % wheel_slots];
+            it->second.expires = expires;
+            it->second.entry = slot.insert(slot.end(), {std::string(session_id), std::string(name), expires});
+        }
+        return true;
+    }
+
+    bool erase(std::string_view session_id, std::string_view name) {
+        auto& s = shard_for(session_id);
+        std::lock_guard lock(s.mutex);
+
+        auto it = s.sessions.find(std::string(session_id));
+        if (it == s.sessions.end()) {
+            return false;
+        }
+        auto c = it->second.cookies.find(std::string(name));
+        if (c == it->second.cookies.end()) {
+            return false;
+        }
+        s.unschedule(c->second);
+        it->second.cookies.erase(c);
+        return true;
+    }
+
+    cookie_list get(std::string_view session_id) {
+        auto const now = now_tick();
+        auto& s = shard_for(session_id);
+        std::lock_guard lock(s.mutex);
+
+        cookie_list result;
+        auto it = s.sessions.find(std::string(session_id));
+        if (it == s.sessions.end()) {
+            return result;
+        }
+        s.lru.splice(s.lru.end(), s.lru, it->second.lru_pos);
+
+        result.reserve(it->second.cookies.size());
+        for (auto const& [name, c] : it->second.cookies) {
+            if (c.expires == 0 || c.expires > now) {
+                result.emplace_back(name, c.value);
+            }
+        }
+        return result;
+    }
+
+    // Advances every shard's wheel to the current second. Called once per
+    // second; catches up if a tick was late.
+    void tick() {
+        auto const now = now_tick();
+        for (auto& s : shards_) {
+            std::lock_guard lock(s.mutex);
+            for (; s.last_tick < now; ++s.last_tick) {
+                s.expire_slot(s.last_tick + 1);
+            }
+        }
+    }
+
+    std::size_t session_count() {
+        std::size_t n = 0;
+        for (auto& s : shards_) {
+            std::lock_guard lock(s.mutex);
+            n += s.sessions.size();
+        }
+        return n;
+    }
+
+private:
+    static constexpr std::size_t wheel_slots = 512;
+
+    struct expiry {
+        std::string session_id;
+        std::string name;
+        std::uint64_t expires;
+    };
+
+    struct cookie {
+        std::string value;
+        std::uint64_t expires = 0;      // tick, 0 for session cookies
+        std::list<expiry>::iterator entry;      // in the wheel, when expires != 0
+    };
+
+    struct session {
+        std::unordered_map<std::string, cookie> cookies;
+        std::list<std::string>::iterator lru_pos;
+    };
+
+    struct shard {
+        std::mutex mutex;
+        std::unordered_map<std::string, session> sessions;
+        std::list<std::string> lru;     // front is the least recently used
+        std::vector<std::list<expiry>> wheel = std::vector<std::list<expiry>>(wheel_slots);
+        std::uint64_t last_tick = 0;
+
+        session& touch(std::string_view session_id, std::size_t max_sessions) {
+            auto it = sessions.find(std::string(session_id));
+            if (it != sessions.end()) {
+                lru.splice(lru.end(), lru, it->second.lru_pos);
+                return it->second;
+            }
+
+            if (sessions.size() >= max_sessions) {
+                auto const evicted = sessions.find(lru.front());
+                for (auto& [name, c] : evicted->second.cookies) {
+                    unschedule(c);
+                }
+                sessions.erase(evicted);
+                lru.pop_front();
+            }
+            lru.emplace_back(session_id);
+            it = sessions.emplace(lru.back(), session{}).first;
+            it->second.lru_pos = std::prev(lru.end());
+            return it->second;
+        }
+
+        void unschedule(cookie& c) {
+            if (c.expires != 0) {
+                wheel[c.expires % wheel_slots].erase(c.entry);
+                c.expires = 0;
+            }
+        }
+
+        // Entries whose deadline is a full revolution away stay in the slot.
+        void expire_slot(std::uint64_t tick) {
+            auto& slot = wheel[tick % wheel_slots];
+            for (auto e = slot.begin(); e != slot.end(); ) {
+                if (e->expires > tick) {
+                    ++e;
+                    continue;
+                }
+                auto it = sessions.find(e->session_id);
+                it->second.cookies.erase(e->name);
+                e = slot.erase(e);
+            }
+        }
+    };
+
+    shard& shard_for(std::string_view session_id) {
+        return shards_[std::hash<std::string_view>{}(session_id) % shards_.size()];
+    }
+
+    std::uint64_t now_tick() const {
+        return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::seconds>(clock::now() - start_).count());
+    }
+
+    std::vector<shard> shards_;
+    std::size_t const max_sessions_per_shard_;
+    clock::time_point const start_;
+};
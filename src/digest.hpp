@@ -0,0 +1,471 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <variant>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// Digests of response bodies for the Content-Digest field (RFC 9530).
+//
+// A digest is fed the body piece by piece, in the order the pieces are
+// written, so it always covers exactly the bytes that went out. It is sent
+// as a trailer after a chunked body, or as a header when the body is known
+// in advance: a seeded /bigfile is the same bytes every time, so the digest
+// of its first transfer is kept in a digest_cache and sent up front after
+// that.
+//
+// crc32c uses the SSE4.2 crc32 instruction and sha-256 the SHA extensions
+// when the CPU has them, chosen at run time. xxh64 is not
+// in the IANA registry and is meant for our own clients; it hashes four
+// independent lanes, which keeps a single core close to memory bandwidth.
+
+enum class digest_algorithm : std::uint8_t {
+    crc32c,
+    sha256,
+    xxh64,
+};
+
+inline std::optional<digest_algorithm> parse_digest_algorithm(std::string_view name) {
+    if (name == "crc32c") {
+        return digest_algorithm::crc32c;
+    }
+    if (name == "sha-256") {
+        return digest_algorithm::sha256;
+    }
+    if (name == "xxh64") {
+        return digest_algorithm::xxh64;
+    }
+    return std::nullopt;
+}
+
+inline char const* digest_name(digest_algorithm algorithm) {
+    switch (algorithm) {
+    case digest_algorithm::crc32c:
+        return "crc32c";
+    case digest_algorithm::sha256:
+        return "sha-256";
+    case digest_algorithm::xxh64:
+        return "xxh64";
+    }
+    return "";
+}
+
+namespace digest {
+
+// CRC-32C (Castagnoli), reflected, as used by iSCSI and ext4.
+class crc32c {
+public:
+    void update(unsigned char const* p, std::size_t n) {
+#if defined(__x86_64__)
+        static bool const hardware = __builtin_cpu_supports("sse4.2");
+        if (hardware) {
+            crc_ = update_sse42(crc_, p, n);
+            return;
+        }
+#endif
+        crc_ = update_table(crc_, p, n);
+    }
+
+    // Big-endian, as the registry specifies.
+    std::string bytes() const {
+        auto const v = ~crc_;
+        return {static_cast<char>(v >> 24), static_cast<char>(v >> 16), static_cast<char>(v >> 8), static_cast<char>(v)};
+    }
+
+private:
+#if defined(__x86_64__)
+    __attribute__((target("sse4.2")))
+    static std::uint32_t update_sse42(std::uint32_t crc, unsigned char const* p, std::size_t n) {
+        std::uint64_t c = crc;
+        for (; n >= 8; p += 8, n -= 8) {
+            std::uint64_t word;
+            std::memcpy(&word, p, 8);
+            c = _mm_crc32_u64(c, word);
+        }
+        auto c32 = static_cast<std::uint32_t>(c);
+        for (; n > 0; ++p, --n) {
+            c32 = _mm_crc32_u8(c32, *p);
+        }
+        return c32;
+    }
+#endif
+
+    static std::uint32_t update_table(std::uint32_t crc, unsigned char const* p, std::size_t n) {
+        static auto const table = [] {
+            std::array<std::uint32_t, 256> t{};
+            for (std::uint32_t i = 0; i < 256; ++i) {
+                auto c = i;
+                for (int k = 0; k < 8; ++k) {
+                    c = c & 1 ? (c >> 1) ^ 0x82f63b78 : c >> 1;
+                }
+                t[i] = c;
+            }
+            return t;
+        }();
+        for (; n > 0; ++p, --n) {
+            crc = table[(crc ^ *p) & 0xff] ^ (crc >> 8);
+        }
+        return crc;
+    }
+
+    std::uint32_t crc_ = 0xffffffff;
+};
+
+// FIPS 180-4 SHA-256.
+class sha256 {
+public:
+    void update(unsigned char const* p, std::size_t n) {
+        length_ += n;
+        if (buffered_ > 0) {
+            auto const take = std::min(n, block_.size() - buffered_);
+            std::memcpy(block_.data() + buffered_, p, take);
+            buffered_ += take;
+            p += take;
+            n -= take;
+            if (buffered_ < block_.size()) {
+                return;
+            }
+            compress(block_.data(), 1);
+            buffered_ = 0;
+        }
+        compress(p, n / 64);
+        p += n / 64 * 64;
+        n %= 64;
+        std::memcpy(block_.data(), p, n);
+        buffered_ = n;
+    }
+
+    std::string bytes() const {
+        sha256 last = *this;
+        auto const bits = length_ * 8;
+        unsigned char const pad = 0x80;
+        last.update(&pad, 1);
+        unsigned char const zero = 0;
+        while (last.buffered_ != 56) {
+            last.update(&zero, 1);
+        }
+        unsigned char len[8];
+        for (int i = 0; i < 8; ++i) {
+            len[i] = static_cast<unsigned char>(bits >> (56 - 8 * i));
+        }
+        last.update(len, 8);
+
+        std::string out;
+        for (auto const h : last.state_) {
+            out += {static_cast<char>(h >> 24), static_cast<char>(h >> 16), static_cast<char>(h >> 8), static_cast<char>(h)};
+        }
+        return out;
+    }
+
+private:
+    alignas(16) static constexpr std::uint32_t k[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+    };
+
+    static std::uint32_t rotr(std::uint32_t x, int n) {
+        return (x >> n) | (x << (32 - n));
+    }
+
+    void compress(unsigned char const* p, std::size_t blocks) {
+#if defined(__x86_64__)
+        static bool const hardware = __builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1");
+        if (hardware) {
+            compress_shani(p, blocks);
+            return;
+        }
+#endif
+        for (; blocks > 0; p += 64, --blocks) {
+            compress_block(p);
+        }
+    }
+
+#if defined(__x86_64__)
+    // Four rounds per step, with the message schedule kept in four vectors
+    // (after Intel's reference code).
+    __attribute__((target("sha,sse4.1")))
+    void compress_shani(unsigned char const* p, std::size_t blocks) {
+        auto const bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+        auto tmp = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<__m128i const*>(&state_[0])), 0xb1);   // CDAB
+        auto state1 = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<__m128i const*>(&state_[4])), 0x1b); // EFGH
+        auto state0 = _mm_alignr_epi8(tmp, state1, 8);                                                       // ABEF
+        state1 = _mm_blend_epi16(state1, tmp, 0xf0);                                                         // CDGH
+
+        for (; blocks > 0; p += 64, --blocks) {
+            auto const abef = state0;
+            auto const cdgh = state1;
+            __m128i w[4];
+            for (int i = 0; i < 16; ++i) {
+                __m128i m;
+                if (i < 4) {
+                    m = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<__m128i const*>(p + 16 * i)), bswap);
+                } else {
+                    m = _mm_sha256msg1_epu32(w[i % 4], w[(i - 3) % 4]);
+                    m = _mm_add_epi32(m, _mm_alignr_epi8(w[(i - 1) % 4], w[(i - 2) % 4], 4));
+                    m = _mm_sha256msg2_epu32(m, w[(i - 1) % 4]);
+                }
+                w[i % 4] = m;
+                auto t = _mm_add_epi32(m, _mm_load_si128(reinterpret_cast<__m128i const*>(k + 4 * i)));
+                state1 = _mm_sha256rnds2_epu32(state1, state0, t);
+                t = _mm_shuffle_epi32(t, 0x0e);
+                state0 = _mm_sha256rnds2_epu32(state0, state1, t);
+            }
+            state0 = _mm_add_epi32(state0, abef);
+            state1 = _mm_add_epi32(state1, cdgh);
+        }
+
+        tmp = _mm_shuffle_epi32(state0, 0x1b);          // FEBA
+        state1 = _mm_shuffle_epi32(state1, 0xb1);       // DCHG
+        state0 = _mm_blend_epi16(tmp, state1, 0xf0);    // DCBA
+        state1 = _mm_alignr_epi8(state1, tmp, 8);       // ABEF
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(&state_[0]), state0);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(&state_[4]), state1);
+    }
+#endif
+
+    void compress_block(unsigned char const* p) {
+        std::uint32_t w[64];
+        for (int i = 0; i < 16; ++i) {
+            w[i] = std::uint32_t(p[4 * i]) << 24 | std::uint32_t(p[4 * i + 1]) << 16 | std::uint32_t(p[4 * i + 2]) << 8 | p[4 * i + 3];
+        }
+        for (int i = 16; i < 64; ++i) {
+            auto const s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            auto const s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        auto a = state_[0], b = state_[1], c = state_[2], d = state_[3];
+        auto e = state_[4], f = state_[5], g = state_[6], h = state_[7];
+        for (int i = 0; i < 64; ++i) {
+            auto const t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+            auto const t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        state_[0] += a;
+        state_[1] += b;
+        state_[2] += c;
+        state_[3] += d;
+        state_[4] += e;
+        state_[5] += f;
+        state_[6] += g;
+        state_[7] += h;
+    }
+
+    std::array<std::uint32_t, 8> state_ = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    std::array<unsigned char, 64> block_{};
+    std::size_t buffered_ = 0;
+    std::uint64_t length_ = 0;
+};
+
+// XXH64 with seed 0.
+class xxh64 {
+public:
+    void update(unsigned char const* p, std::size_t n) {
+        length_ += n;
+        if (buffered_ > 0) {
+            auto const take = std::min(n, block_.size() - buffered_);
+            std::memcpy(block_.data() + buffered_, p, take);
+            buffered_ += take;
+            p += take;
+            n -= take;
+            if (buffered_ < block_.size()) {
+                return;
+            }
+            stripe(block_.data());
+            buffered_ = 0;
+        }
+        for (; n >= 32; p += 32, n -= 32) {
+            stripe(p);
+        }
+        std::memcpy(block_.data(), p, n);
+        buffered_ = n;
+    }
+
+    std::string bytes() const {
+        std::uint64_t h = length_ >= 32
+            ? merge(merge(merge(merge(rotl(v_[0], 1) + rotl(v_[1], 7) + rotl(v_[2], 12) + rotl(v_[3], 18), v_[0]), v_[1]), v_[2]), v_[3])
+            : v_[2] + prime5;
+        h += length_;
+
+        auto const* p = block_.data();
+        auto n = buffered_;
+        for (; n >= 8; p += 8, n -= 8) {
+            h ^= round(0, read64(p));
+            h = rotl(h, 27) * prime1 + prime4;
+        }
+        if (n >= 4) {
+            h ^= std::uint64_t(read32(p)) * prime1;
+            h = rotl(h, 23) * prime2 + prime3;
+            p += 4;
+            n -= 4;
+        }
+        for (; n > 0; ++p, --n) {
+            h ^= *p * prime5;
+            h = rotl(h, 11) * prime1;
+        }
+        h ^= h >> 33;
+        h *= prime2;
+        h ^= h >> 29;
+        h *= prime3;
+        h ^= h >> 32;
+
+        std::string out;
+        for (int i = 7; i >= 0; --i) {
+            out += static_cast<char>(h >> (8 * i));
+        }
+        return out;
+    }
+
+private:
+    static constexpr std::uint64_t prime1 = 0x9e3779b185ebca87;
+    static constexpr std::uint64_t prime2 = 0xc2b2ae3d27d4eb4f;
+    static constexpr std::uint64_t prime3 = 0x165667b19e3779f9;
+    static constexpr std::uint64_t prime4 = 0x85ebca77c2b2ae63;
+    static constexpr std::uint64_t prime5 = 0x27d4eb2f165667c5;
+
+    static std::uint64_t rotl(std::uint64_t x, int n) {
+        return (x << n) | (x >> (64 - n));
+    }
+
+    static std::uint64_t read64(unsigned char const* p) {
+        std::uint64_t v;
+        std::memcpy(&v, p, 8);
+        return v;
+    }
+
+    static std::uint32_t read32(unsigned char const* p) {
+        std::uint32_t v;
+        std::memcpy(&v, p, 4);
+        return v;
+    }
+
+    static std::uint64_t round(std::uint64_t acc, std::uint64_t input) {
+        return rotl(acc + input * prime2, 31) * prime1;
+    }
+
+    static std::uint64_t merge(std::uint64_t h, std::uint64_t v) {
+        return (h ^ round(0, v)) * prime1 + prime4;
+    }
+
+    void stripe(unsigned char const* p) {
+        v_[0] = round(v_[0], read64(p));
+        v_[1] = round(v_[1], read64(p + 8));
+        v_[2] = round(v_[2], read64(p + 16));
+        v_[3] = round(v_[3], read64(p + 24));
+    }
+
+    std::array<std::uint64_t, 4> v_ = {prime1 + prime2, prime2, 0, 0 - prime1};
+    std::array<unsigned char, 32> block_{};
+    std::size_t buffered_ = 0;
+    std::uint64_t length_ = 0;
+};
+
+inline std::string base64(std::string_view bytes) {
+    static constexpr char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    out.reserve((bytes.size() + 2) / 3 * 4);
+    for (std::size_t i = 0; i < bytes.size(); i += 3) {
+        std::uint32_t v = std::uint32_t(static_cast<unsigned char>(bytes[i])) << 16;
+        if (i + 1 < bytes.size()) {
+            v |= std::uint32_t(static_cast<unsigned char>(bytes[i + 1])) << 8;
+        }
+        if (i + 2 < bytes.size()) {
+            v |= static_cast<unsigned char>(bytes[i + 2]);
+        }
+        out += alphabet[(v >> 18) & 63];
+        out += alphabet[(v >> 12) & 63];
+        out += i + 1 < bytes.size() ? alphabet[(v >> 6) & 63] : '=';
+        out += i + 2 < bytes.size() ? alphabet[v & 63] : '=';
+    }
+    return out;
+}
+
+} // namespace digest
+
+// One running digest of a body.
+class content_digest {
+public:
+    explicit content_digest(digest_algorithm algorithm)
+        : algorithm_(algorithm)
+    {
+        switch (algorithm) {
+        case digest_algorithm::crc32c:
+            state_.emplace<digest::crc32c>();
+            break;
+        case digest_algorithm::sha256:
+            state_.emplace<digest::sha256>();
+            break;
+        case digest_algorithm::xxh64:
+            state_.emplace<digest::xxh64>();
+            break;
+        }
+    }
+
+    void update(void const* data, std::size_t n) {
+        std::visit([&](auto& s) { s.update(static_cast<unsigned char const*>(data), n); }, state_);
+    }
+
+    // The Content-Digest value, "sha-256=:<base64>:".
+    std::string field_value() const {
+        auto const bytes = std::visit([](auto const& s) { return s.bytes(); }, state_);
+        return std::string(digest_name(algorithm_)) + "=:" + digest::base64(bytes) + ":";
+    }
+
+private:
+    digest_algorithm algorithm_;
+    std::variant<digest::crc32c, digest::sha256, digest::xxh64> state_;
+};
+
+// Content-Digest values of deterministic bodies, by whatever key identifies
+// the bytes. Bounded: when full it is simply emptied.
+class digest_cache {
+public:
+    static constexpr std::size_t max_entries = 4096;
+
+    std::optional<std::string> find(std::string const& key) {
+        std::lock_guard lock(mutex_);
+        auto const it = entries_.find(key);
+        if (it == entries_.end()) {
+            return std::nullopt;
+        }
+        return it->second;
+    }
+
+    void insert(std::string key, std::string value) {
+        std::lock_guard lock(mutex_);
+        if (entries_.size() >= max_entries) {
+            entries_.clear();
+        }
+        entries_.insert_or_assign(std::move(key), std::move(value));
+    }
+
+private:
+    std::mutex mutex_;
+    std::unordered_map<std::string, std::string> entries_;
+};
@@ -0,0 +1,256 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <string_view>
+
+// application/x-www-form-urlencoded bodies and URL query strings.
+//
+// Parsing allocates nothing: form::fields walks the input with memchr and
+// yields each pair as string_views into it, still encoded. Decoding ("%20"
+// and "+" to a space) happens only when asked for: comparisons decode on the
+// fly, and decode() writes into caller-provided scratch space only when the
+// text actually contains an escape.
+
+namespace form {
+
+inline int hex_digit(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+// Decodes the character at raw[i] and advances i past it. A '%' that does not
+// start a valid escape is taken literally.
+inline char decode_next(std::string_view raw, std::size_t& i) {
+    char const c = raw[i++];
+    if (c == '+') {
+        return ' ';
+    }
+    if (c == '%' && i + 2 <= raw.size()) {
+        int const hi = hex_digit(raw[i]);
+        int const lo = hex_digit(raw[i + 1]);
+        if (hi >= 0 && lo >= 0) {
+            i += 2;
+            return static_cast<char>(hi * 16 + lo);
+        }
+    }
+    return c;
+}
+
+inline bool needs_decoding(std::string_view raw) {
+    for (char const c : raw) {
+        if (c == '%' || c == '+') {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Compares encoded text against plain text without materializing it.
+inline bool decoded_equals(std::string_view raw, std::string_view plain) {
+    // Decoding never makes text longer.
+    if (raw.size() < plain.size()) {
+        return false;
+    }
+    std::size_t i = 0;
+    std::size_t j = 0;
+    while (i < raw.size()) {
+        if (j == plain.size() || decode_next(raw, i) != plain[j++]) {
+            return false;
+        }
+    }
+    return j == plain.size();
+}
+
+inline void append_decoded(std::string_view raw, std::string& out) {
+    for (std::size_t i = 0; i < raw.size();) {
+        out += decode_next(raw, i);
+    }
+}
+
+// The decoded text: raw itself when there is nothing to decode, otherwise a
+// view of scratch, which is overwritten.
+inline std::string_view decode(std::string_view raw, std::string& scratch) {
+    if ( ! needs_decoding(raw)) {
+        return raw;
+    }
+    scratch.clear();
+    append_decoded(raw, scratch);
+    return scratch;
+}
+
+// One "key=value" pair, as it appears in the input. A pair without '=' has an
+// empty value.
+struct field {
+    std::string_view raw_key;
+    std::string_view raw_value;
+
+    bool key_is(std::string_view key) const {
+        return decoded_equals(raw_key, key);
+    }
+
+    bool value_is(std::string_view value) const {
+        return decoded_equals(raw_value, value);
+    }
+};
+
+class fields {
+public:
+    class iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = field;
+        using difference_type = std::ptrdiff_t;
+        using pointer = field const*;
+        using reference = field const&;
+
+        iterator() = default;
+
+        explicit iterator(std::string_view rest)
+            : rest_(rest)
+            , done_(false)
+        {
+            advance();
+        }
+
+        reference operator*() const {
+            return current_;
+        }
+
+        pointer operator->() const {
+            return &current_;
+        }
+
+        iterator& operator++() {
+            advance();
+            return *this;
+        }
+
+        iterator operator++(int) {
+            auto tmp = *this;
+            advance();
+            return tmp;
+        }
+
+        bool operator==(iterator const& other) const {
+            return done_ == other.done_ && (done_ || rest_.data() == other.rest_.data());
+        }
+
+    private:
+        void advance() {
+            // Empty pairs ("a=1&&b=2") are skipped.
+            while ( ! rest_.empty()) {
+                auto const* amp = static_cast<char const*>(std::memchr(rest_.data(), '&', rest_.size()));
+                auto const len = amp ? static_cast<std::size_t>(amp - rest_.data()) : rest_.size();
+                std::string_view const pair = rest_.substr(0, len);
+                rest_.remove_prefix(amp ? len + 1 : len);
+
+                if (pair.empty()) {
+                    continue;
+                }
+                auto const* eq = static_cast<char const*>(std::memchr(pair.data(), '=', pair.size()));
+                if (eq) {
+                    auto const key_len = static_cast<std::size_t>(eq - pair.data());
+                    current_ = {pair.substr(0, key_len), pair.substr(key_len + 1)};
+                } else {
+                    current_ = {pair, {}};
+                }
+                return;
+            }
+            done_ = true;
+        }
+
+        std::string_view rest_;
+        field current_;
+        bool done_ = true;
+    };
+
+    explicit fields(std::string_view input)
+        : input_(input)
+    {}
+
+    // The query string of a request target, or nothing if it has none.
+    static fields of_query(std::string_view target) {
+        auto const pos = target.find('?');
+        return fields(pos == std::string_view::npos ? std::string_view{} : target.substr(pos + 1));
+    }
+
+    iterator begin() const {
+        return iterator(input_);
+    }
+
+    iterator end() const {
+        return iterator();
+    }
+
+    // The first field whose decoded key is `key`.
+    std::optional<field> find(std::string_view key) const {
+        for (auto const& f : *this) {
+            if (f.key_is(key)) {
+                return f;
+            }
+        }
+        return std::nullopt;
+    }
+
+    // Whether the last field named key decodes to value: with repeated keys
+    // the last one wins, as when the fields are collected into a map.
+    bool last_is(std::string_view key, std::string_view value) const {
+        bool matched = false;
+        for (auto const& f : *this) {
+            if (f.key_is(key)) {
+                matched = f.value_is(value);
+            }
+        }
+        return matched;
+    }
+
+    // Whether every (key, value) in expected is present, last value winning,
+    // in a single pass over the input. Meant for the handful of fields a
+    // handler checks.
+    template <typename Pairs>
+    bool contains_all(Pairs const& expected) const {
+        std::size_t const n = std::size(expected);
+        if (n > 64) {
+            for (auto const& [key, value] : expected) {
+                if ( ! last_is(key, value)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // A bit per expected pair, set while the latest field with its key
+        // has its value.
+        std::uint64_t const all = n == 64 ? ~std::uint64_t(0) : (std::uint64_t(1) << n) - 1;
+        std::uint64_t found = 0;
+        for (auto const& f : *this) {
+            std::size_t bit = 0;
+            for (auto const& [key, value] : expected) {
+                if (f.key_is(key)) {
+                    auto const mask = std::uint64_t(1) << bit;
+                    found = f.value_is(value) ? found | mask : found & ~mask;
+                }
+                ++bit;
+            }
+        }
+        return found == all;
+    }
+
+private:
+    std::string_view input_;
+};
+
+} // namespace form
@@ -4,28 +4,34 @@
 #include <cstdlib>
 #include <iostream>
 #include <filesystem>
-#include <fstream>
 #include <memory>
-#include <random>
+#include <optional>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <thread>
 #include <vector>
 
-#include <boost/algorithm/string.hpp>
+#include <unistd.h>
 
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/awaitable.hpp>
 #include <boost/asio/co_spawn.hpp>
+#include <boost/asio/redirect_error.hpp>
+#include <boost/asio/signal_set.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
 #include <boost/asio/use_awaitable.hpp>
 
 #include <boost/beast/core.hpp>
 #include <boost/beast/http.hpp>
-#include <boost/beast/version.hpp>
-
-#include <boost/json.hpp>
 
 #include <boost/config.hpp>
-#include <boost/url.hpp>
+
+#include "prefork.hpp"
+#include "proxy.hpp"
+#include "server_state.hpp"
+#include "session.hpp"
 
 namespace beast = boost::beast;
 namespace http = beast::http;
@@ -35,561 +41,315 @@ using tcp = boost::asio::ip::tcp;
 // using tcp_stream = typename beast::tcp_stream::rebind_executor<
 //         net::use_awaitable_t<>::executor_with_default<net::any_io_executor>>::other;
 
-std::unordered_map<std::string, std::string> parse_form_data(const std::string& body) {
-    std::unordered_map<std::string, std::string> data;
-    std::istringstream stream(body);
-    std::string pair;
-
-    while (std::getline(stream, pair, '&')) {
-        size_t pos = pair.find('=');
-        if (pos != std::string::npos) {
-            std::string key = pair.substr(0, pos);
-            std::string value = pair.substr(pos + 1);
-            data[key] = value;
-        }
+//------------------------------------------------------------------------------
+
+net::awaitable<void> do_expire_cookies(server_state& state) {
+    net::steady_timer timer(co_await net::this_coro::executor);
+    for(;;) {
+        timer.expires_after(virtual_clock::to_real(std::chrono::seconds(1)));
+        co_await timer.async_wait(net::use_awaitable);
+        state.cookies.tick();
     }
-    return data;
 }
 
-template <typename Body, typename Allocator>
-http::message_generator handle_request(http::request<Body, http::basic_fields<Allocator>>&& req) {
-    auto const bad_request = [&req](beast::string_view why) {
-        http::response<http::string_body> res{http::status::bad_request, req.version()};
-        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-        res.set(http::field::content_type, "text/html");
-        res.keep_alive(req.keep_alive());
-        res.body() = std::string(why);
-        res.prepare_payload();
-        return res;
-    };
-
-    auto const not_found = [&req](beast::string_view target) {
-        http::response<http::string_body> res{http::status::not_found, req.version()};
-        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-        res.set(http::field::content_type, "text/html");
-        res.keep_alive(req.keep_alive());
-        res.body() = "The resource '" + std::string(target) + "' was not found.";
-        res.prepare_payload();
-        return res;
-    };
-
-    auto const server_error = [&req](beast::string_view what) {
-        http::response<http::string_body> res{http::status::internal_server_error, req.version()};
-        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-        res.set(http::field::content_type, "text/html");
-        res.keep_alive(req.keep_alive());
-        res.body() = "An error occurred: '" + std::string(what) + "'";
-        res.prepare_payload();
-        return res;
-    };
-
-    std::cout << "Request: " << req.target() << '\n';
-
-    // if (req.method() != http::verb::get && req.method() != http::verb::post) {
-    //     return bad_request("Unknown HTTP-method");
-    // }
-
-    // Handling /echo
-    if (req.target() == "/echo" && req.method() == http::verb::post) {
-        http::response<http::string_body> res{http::status::ok, req.version()};
-        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-        res.set(http::field::content_type, "text/plain");
-        res.keep_alive(req.keep_alive());
-        res.body() = req.body();
-        res.prepare_payload();
-        return res;
+// Samples event loop lag for admission control: how late a timer that was
+// due fires.
+net::awaitable<void> do_measure_lag(server_state& state) {
+    net::steady_timer timer(co_await net::this_coro::executor);
+    for(;;) {
+        timer.expires_after(std::chrono::milliseconds(10));
+        co_await timer.async_wait(net::use_awaitable);
+        auto const now = std::chrono::steady_clock::now();
+        state.admission.record_lag(now - timer.expiry(), now);
     }
+}
 
-    // Handling /timestamp
-    if (req.target() == "/timestamp" && req.method() == http::verb::get) {
-        auto now = std::chrono::system_clock::now();
-        std::time_t now_time = std::chrono::system_clock::to_time_t(now);
-        http::response<http::string_body> res{http::status::ok, req.version()};
-        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-        res.set(http::field::content_type, "text/plain");
-        res.keep_alive(req.keep_alive());
-        res.body() = std::ctime(&now_time);
-        res.prepare_payload();
-        return res;
-    }
+//------------------------------------------------------------------------------
 
-    // Handling /status
-    if (req.target() == "/status" && req.method() == http::verb::get) {
-        http::response<http::string_body> res{http::status::ok, req.version()};
-        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-        res.set(http::field::content_type, "text/plain");
-        res.keep_alive(req.keep_alive());
-        res.body() = "Server is running smoothly!";
-        res.prepare_payload();
-        return res;
+void reload_scenario(server_state& state) {
+    try {
+        auto table = scenario::load(state.options.scenario_file);
+        std::cout << "Scenario loaded: " << state.options.scenario_file.string() << " (" << table->size() << " routes)\n";
+        state.scenarios.publish(std::move(table));
+    } catch (std::exception& e) {
+        // Keep serving the previous table.
+        std::cerr << "Error loading scenario: " << e.what() << "\n";
     }
+}
 
-    // Handling /bigfile
-    if (req.target().starts_with("/bigfile")) {
-        boost::url_view url = req.target();
-        auto params = boost::urls::parse_query(url.encoded_query());
-        if ( ! params) {
-            return bad_request("Invalid query string");
-        }
-
-        if (params->size() != 3) {
-            return bad_request("Invalid query string");
-        }
-
-        // 1000000, 4096, 50
-        size_t total_size = 0;
-        size_t chunk_size = 0;
-        size_t delay_ms = 0;
-
-        for (auto const& param : *params) {
-            if (param.key == "total_size") {
-                std::from_chars(param.value.data(), param.value.data() + param.value.size(), total_size);
-            } else if (param.key == "chunk_size") {
-                std::from_chars(param.value.data(), param.value.data() + param.value.size(), chunk_size);
-            } else if (param.key == "delay_ms") {
-                std::from_chars(param.value.data(), param.value.data() + param.value.size(), delay_ms);
-            }
-        }
-
-        std::random_device rd;
-        std::mt19937 gen(rd());
-        std::uniform_int_distribution<> distrib(0, 255);
-
-        std::vector<uint8_t> body;
-        body.reserve(total_size);
+net::awaitable<void> do_watch_scenario(server_state& state) {
+    net::steady_timer timer(co_await net::this_coro::executor);
+    std::error_code ec;
+    auto last_write = std::filesystem::last_write_time(state.options.scenario_file, ec);
 
-        for (size_t sent = 0; sent < total_size; sent += chunk_size) {
-            std::vector<uint8_t> chunk;
-            chunk.reserve(chunk_size);
-            for(size_t i = 0; i < chunk_size && sent + i < total_size; ++i) {
-                chunk.push_back(static_cast<uint8_t>(distrib(gen)));
-            }
-            body.insert(body.end(), chunk.begin(), chunk.end());
+    for(;;) {
+        timer.expires_after(std::chrono::seconds(1));
+        co_await timer.async_wait(net::use_awaitable);
 
-            if (sent + chunk_size < total_size) {
-                std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms));
-            }
+        auto const write_time = std::filesystem::last_write_time(state.options.scenario_file, ec);
+        if ( ! ec && write_time != last_write) {
+            last_write = write_time;
+            reload_scenario(state);
         }
-
-        http::response<http::vector_body<uint8_t>> res {
-            std::piecewise_construct,
-            std::make_tuple(std::move(body)),
-            std::make_tuple(http::status::ok, req.version())
-        };
-        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-        res.set(http::field::content_type, "application/octet-stream");
-        res.content_length(total_size);
-        res.keep_alive(req.keep_alive());
-        return res;
     }
+}
 
-
-
-    // connection.cpp
-    // Handling /headers
-    if (req.target() == "/headers" && req.method() == http::verb::get) {
-        http::response<http::string_body> res{http::status::ok, req.version()};
-        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-        res.set(http::field::content_type, "application/json");
-        res.keep_alive(req.keep_alive());
-
-        boost::json::object headers_obj;
-        for (const auto& header : req) {
-            headers_obj[header.name_string()] = header.value();
-        }
-        boost::json::object response_obj;
-        response_obj["headers"] = headers_obj;
-
-        res.body() = boost::json::serialize(response_obj);
-        res.prepare_payload();
-        return res;
+net::awaitable<void> do_reload_on_sighup(server_state& state) {
+    net::signal_set signals(co_await net::this_coro::executor, SIGHUP);
+    for(;;) {
+        co_await signals.async_wait(net::use_awaitable);
+        reload_scenario(state);
     }
+}
 
-    // get-redirect
-    if (req.target().starts_with("/redirect-to?url=")) {
-        http::response<http::string_body> res{http::status::found, req.version()};
-        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-
-        std::string target_url = req.target().substr(18);
-        if (target_url == "%2Fget") {
-            target_url = "/get";  // ????
-        }
-
-        res.set(http::field::location, target_url);
-
-        if (target_url == "/get") {
-            res.set(http::field::content_type, "application/json");
-            boost::json::object headers_obj;
+//------------------------------------------------------------------------------
 
-            for (const auto& header : req) {
-                headers_obj[header.name_string()] = header.value();
-            }
-            boost::json::object response_obj;
-            response_obj["headers"] = headers_obj;
-            res.body() = boost::json::serialize(response_obj);
+void log_exception(char const* where, std::exception_ptr e) {
+    if (e) {
+        try {
+            std::rethrow_exception(e);
+        } catch(std::exception & e) {
+            std::cerr << "Error in " << where << ": " << e.what() << "\n";
         }
-
-        res.prepare_payload();
-        return res;
     }
+}
 
-    // too-many-redirects
-    if (req.target().starts_with("/redirect/")) {
-        http::response<http::string_body> res{http::status::found, req.version()};
-        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-
-        std::string redirect_count_str = req.target().substr(10);
-        int redirect_count = std::atoi(redirect_count_str.c_str());
-
-        if (redirect_count > 0) {
-            --redirect_count;
-
-            std::string next_redirect = "/redirect/" + std::to_string(redirect_count);
-            res.set(http::field::location, next_redirect);
-        } else {
-            res.result(http::status::ok);
-            res.set(http::field::content_type, "application/json");
-            boost::json::object response_obj;
-            response_obj["message"] = "Final destination reached!";
-            res.body() = boost::json::serialize(response_obj);
+using acceptor_type = net::use_awaitable_t<>::as_default_on_t<tcp::acceptor>;
+
+// A prefork worker that is told to stop closes its copy of the listening
+// socket, which the other processes keep accepting on, and exits once its
+// requests and proxied connections are done. Connections idle between
+// requests go with the process.
+net::awaitable<void> do_drain_on_sigterm(std::shared_ptr<acceptor_type> acceptor, server_state& state, net::io_context& ioc) {
+    net::signal_set signals(co_await net::this_coro::executor, SIGTERM);
+    co_await signals.async_wait(net::use_awaitable);
+    acceptor->close();
+
+    // A short grace period lets connections just accepted send their
+    // first request.
+    auto const start = std::chrono::steady_clock::now();
+    auto const deadline = start + state.options.prefork.drain_timeout;
+    net::steady_timer timer(co_await net::this_coro::executor);
+    for(;;) {
+        auto const now = std::chrono::steady_clock::now();
+        bool const idle = state.admission.in_flight() == 0 && state.proxied.load(std::memory_order_relaxed) == 0;
+        if (now >= deadline || (idle && now - start >= std::chrono::seconds(1))) {
+            break;
         }
-
-        res.prepare_payload();
-        return res;
+        timer.expires_after(std::chrono::milliseconds(100));
+        co_await timer.async_wait(net::use_awaitable);
     }
+    ioc.stop();
+}
 
-    // download
-    if (req.target() == "/image") {
-        std::filesystem::path image_path = "requests-test.png";   //TODO
-
-        if ( ! std::filesystem::exists(image_path)) {
-            http::response<http::string_body> res{http::status::not_found, req.version()};
-            res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-            res.set(http::field::content_type, "text/plain");
-            res.body() = "File not found";
-            res.prepare_payload();
-
-            return res;
-        }
-
-        std::ifstream file(image_path.string(), std::ios::binary);
-        std::vector<char> file_content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
-
-        http::response<http::vector_body<char>> res{http::status::ok, req.version()};
-        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-        res.set(http::field::content_type, "image/png");
-        res.content_length(file_content.size());
-        res.body() = file_content;
-
-        return res;
+// Runs on a strand of its own, so that a drain can close the acceptor.
+// listen_fd is a listening socket inherited from a prefork master.
+net::awaitable<void> do_listen(tcp::endpoint endpoint, server_state& state, net::io_context& ioc, int listen_fd) {
+    auto acceptor = std::make_shared<acceptor_type>(co_await net::this_coro::executor);
+    if (listen_fd >= 0) {
+        acceptor->assign(endpoint.protocol(), listen_fd);
+    } else {
+        acceptor->open(endpoint.protocol());
+        acceptor->set_option(net::socket_base::reuse_address(true));
+        acceptor->bind(endpoint);
+        acceptor->listen(net::socket_base::max_listen_connections);
     }
-
-    // download-redirect
-    if (req.target() == "/redirect-to?url=%2Fimage") {
-        http::response<http::string_body> res{http::status::found, req.version()};
-        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-        res.set(http::field::location, "/image");
-        return res;
+    if (state.worker) {
+        state.worker->pid.store(::getpid(), std::memory_order_relaxed);
+        boost::asio::co_spawn(acceptor->get_executor(), do_drain_on_sigterm(acceptor, state, ioc), [](std::exception_ptr e) {
+            log_exception("drain", e);
+        });
     }
 
-    // delete
-    if (req.method() == http::verb::delete_ && req.target() == "/delete") {
-        boost::json::value val = boost::json::parse(req.body());
-        boost::json::object& obj = val.as_object();
-
-        std::string test_key;
-        if (obj.contains("test-key")) {
-            test_key = obj["test-key"].as_string().c_str();
+    // Sessions run on the io_context, not on the acceptor's strand.
+    net::any_io_executor const ex = ioc.get_executor();
+    for(;;) {
+        boost::system::error_code ec;
+        auto socket = co_await acceptor->async_accept(ex, net::redirect_error(net::use_awaitable, ec));
+        if (ec == net::error::operation_aborted && ! acceptor->is_open()) {
+            co_return;
         }
-
-        if (test_key == "test-value") {
-            http::response<http::string_body> res{http::status::ok, req.version()};
-            res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-            res.set(http::field::content_type, "application/json");
-            res.body() = R"({"status": "success"})";
-            res.prepare_payload();
-            return res;
-        } else {
-            http::response<http::string_body> res{http::status::bad_request, req.version()};
-            res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-            res.set(http::field::content_type, "application/json");
-            res.body() = R"({"status": "failure"})";
-            res.prepare_payload();
-            return res;
+        if (ec) {
+            throw boost::system::system_error(ec);
         }
-    }
-
-    // patch-json
-    if (req.method() == http::verb::patch && req.target() == "/patch") {
-        std::string body_str(req.body().begin(), req.body().end());
-        boost::json::value jv = boost::json::parse(body_str);
-        boost::json::object obj = jv.as_object();
-
-        if (obj["test-key"].as_string() == "test-value") {
-            http::response<http::string_body> res{http::status::ok, req.version()};
-            res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-            res.set(http::field::content_type, "application/json");
-            res.body() = R"({"status": "success"})";
-            res.prepare_payload();
-
-            return res;
-        } else {
-            http::response<http::string_body> res{http::status::bad_request, req.version()};
-            res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-            res.set(http::field::content_type, "application/json");
-            res.body() = R"({"status": "failure"})";
-            res.prepare_payload();
-
-            return res;
+        auto const accepted = request_trace::clock::now();
+        state.connections.fetch_add(1, std::memory_order_relaxed);
+        if (state.worker) {
+            state.worker->connections.fetch_add(1, std::memory_order_relaxed);
         }
-    }
 
-    // patch-form
-    if (req.method() == http::verb::patch && req.target() == "/patch" &&
-        req[http::field::content_type] == "application/x-www-form-urlencoded") {
-        std::string body_str(req.body().begin(), req.body().end());
-        std::vector<std::string> tokens;
-        boost::split(tokens, body_str, boost::is_any_of("&"));
-
-        boost::json::object obj;
-        for (const auto& token : tokens) {
-            std::vector<std::string> kv;
-            boost::split(kv, token, boost::is_any_of("="));
-            if (kv.size() == 2) {
-                obj[kv[0]] = kv[1];
-            }
+        if (state.options.proxy.enabled()) {
+            // Both directions of a proxied connection share its state.
+            state.proxied.fetch_add(1, std::memory_order_relaxed);
+            boost::asio::co_spawn(
+                net::make_strand(ex),
+                do_proxy(std::move(socket), state.options.proxy, state.timers),
+                [&state](std::exception_ptr e) {
+                    state.proxied.fetch_sub(1, std::memory_order_relaxed);
+                    log_exception("proxy", e);
+                });
+            continue;
         }
 
-        http::response<http::string_body> res{http::status::ok, req.version()};
-        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-        res.set(http::field::content_type, "application/x-www-form-urlencoded");
-        std::string serialized_json = boost::json::serialize(boost::json::value_from(obj));
-        res.body() = R"({"status": "success", "form": )" + serialized_json + "}";
-        res.prepare_payload();
-
-        return res;
+        boost::asio::co_spawn(
+            ex,
+                // do_session(tcp_stream(co_await acceptor.async_accept())),
+                do_session(std::move(socket), state, accepted),
+                [](std::exception_ptr e) {
+                    if (e) {
+                        try {
+                            std::rethrow_exception(e);
+                        } catch (std::exception &e) {
+                            std::cerr << "Error in session: " << e.what() << "\n";
+                        }
+                    }
+                });
     }
+}
 
-    // put-form
-    if (req.method() == http::verb::put && req.target() == "/put" &&
-        req[http::field::content_type] == "application/x-www-form-urlencoded") {
-
-        auto form_data = parse_form_data(req.body());
+template <typename T>
+bool parse_number(std::string_view value, T& out) {
+    auto const [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), out);
+    return ec == std::errc() && ptr == value.data() + value.size();
+}
 
-        if (form_data["foo"] == "42" && form_data["bar"] == "21" && form_data["foo bar"] == "23") {
-            http::response<http::string_body> res{http::status::ok, req.version()};
-            res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-            res.set(http::field::content_type, "application/x-www-form-urlencoded");
-            res.body() = "foo=42&bar=21&foo%20bar=23";
-            res.prepare_payload();
-            return res;
-        } else {
-            http::response<http::string_body> res{http::status::bad_request, req.version()};
-            res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-            res.set(http::field::content_type, "text/plain");
-            res.body() = "Invalid form data";
-            res.prepare_payload();
-            return res;
-        }
+bool parse_number(std::string_view value, bool& out) {
+    if (value != "0" && value != "1") {
+        return false;
     }
+    out = value == "1";
+    return true;
+}
 
-    // put-json
-    if (req.method() == http::verb::put && req.target() == "/put" &&
-        req[http::field::content_type] == "application/json") {
-
-        boost::json::value json_value = boost::json::parse(req.body());
-
-        if (json_value.is_object() &&
-            json_value.as_object().contains("test-key") &&
-            json_value.as_object()["test-key"] == "test-value") {
-
-            http::response<http::string_body> res{http::status::ok, req.version()};
-            res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-            res.set(http::field::content_type, "application/json");
-            res.body() = R"({"status": "success"})";
-            res.prepare_payload();
-
-            return res;
-        }
+template <typename Rep, typename Period>
+bool parse_number(std::string_view value, std::chrono::duration<Rep, Period>& out) {
+    Rep count;
+    if ( ! parse_number(value, count)) {
+        return false;
     }
+    out = std::chrono::duration<Rep, Period>(count);
+    return true;
+}
 
-    // post-form
-    if (req.method() == http::verb::post && req.target() == "/post" &&
-        req[http::field::content_type] == "application/x-www-form-urlencoded") {
-
-        auto form_data = parse_form_data(req.body());
-
-        if (form_data["foo"] == "42" && form_data["bar"] == "21" && form_data["foo bar"] == "23") {
-            http::response<http::string_body> res{http::status::ok, req.version()};
-            res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-            res.set(http::field::content_type, "application/x-www-form-urlencoded");
-            res.body() = "foo=42&bar=21&foo%20bar=23";
-            res.prepare_payload();
-            return res;
-        } else {
-            http::response<http::string_body> res{http::status::bad_request, req.version()};
-            res.body() = "Invalid form data";
-            res.prepare_payload();
-            return res;
+bool parse_options(int argc, char* argv[], server_options& options) {
+    for (int i = 4; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        auto const eq = arg.find('=');
+        if ( ! arg.starts_with("--") || eq == std::string_view::npos) {
+            std::cerr << "Invalid option: " << arg << "\n";
+            return false;
         }
-    }
-
-    // post-json
-    if (req.method() == http::verb::post && req.target() == "/post" &&
-        req[http::field::content_type] == "application/json") {
-
-        auto json_data = boost::json::parse(req.body());
-
-        if (json_data.at("test-key").as_string() == "test-value") {
-            http::response<http::string_body> res{http::status::ok, req.version()};
-            res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-            res.set(http::field::content_type, "application/json");
-            res.body() = R"({"message":"Data received"})";
-            res.prepare_payload();
-            return res;
+        auto const name = arg.substr(2, eq - 2);
+        auto const value = arg.substr(eq + 1);
+
+        bool ok = true;
+        if (name == "scenario") {
+            options.scenario_file = value;
+        } else if (name == "cookie-sessions") {
+            ok = parse_number(value, options.cookie_sessions);
+        } else if (name == "log-requests") {
+            ok = parse_number(value, options.log_requests);
+        } else if (name == "cache-control") {
+            options.cache_control = value;
+        } else if (name == "upload-dir") {
+            options.upload_dir = value;
+        } else if (name == "max-lag-ms") {
+            ok = parse_number(value, options.admission.target_lag);
+        } else if (name == "max-in-flight") {
+            ok = parse_number(value, options.admission.max_in_flight);
+        } else if (name == "retry-after") {
+            ok = parse_number(value, options.admission.retry_after);
+        } else if (name == "server-timing") {
+            ok = parse_number(value, options.tracing.server_timing);
+        } else if (name == "trace-sample") {
+            ok = parse_number(value, options.tracing.sample_every);
+        } else if (name == "socket-tuning") {
+            ok = parse_number(value, options.sockets.enabled);
+        } else if (name == "tcp-nodelay") {
+            ok = parse_number(value, options.sockets.small.no_delay);
+        } else if (name == "stream-sndbuf") {
+            ok = parse_number(value, options.sockets.stream.send_buffer);
+        } else if (name == "stream-lowat") {
+            ok = parse_number(value, options.sockets.stream.notsent_lowat);
+        } else if (name == "stream-cork") {
+            ok = parse_number(value, options.sockets.stream.cork);
+        } else if (name == "clock-speedup") {
+            ok = parse_number(value, options.clock_speedup) && options.clock_speedup > 0;
+        } else if (name == "workers") {
+            ok = parse_number(value, options.prefork.workers) && options.prefork.workers <= shared_stats::segment::max_workers;
+        } else if (name == "drain-timeout") {
+            ok = parse_number(value, options.prefork.drain_timeout);
+        } else if (name == "proxy") {
+            options.proxy.upstream = value;
+        } else if (name == "proxy-latency-ms") {
+            ok = parse_number(value, options.proxy.latency);
+        } else if (name == "proxy-jitter-ms") {
+            ok = parse_number(value, options.proxy.jitter);
+        } else if (name == "proxy-bandwidth") {
+            ok = parse_number(value, options.proxy.bandwidth_bytes_per_sec);
+        } else if (name == "proxy-chunk") {
+            ok = parse_number(value, options.proxy.chunk_size);
+        } else if (name == "proxy-reset-rate") {
+            ok = parse_number(value, options.proxy.reset_rate) && options.proxy.reset_rate >= 0 && options.proxy.reset_rate <= 1;
+        } else if (name == "proxy-seed") {
+            ok = parse_number(value, options.proxy.seed.emplace());
         } else {
-            http::response<http::string_body> res{http::status::bad_request, req.version()};
-            res.body() = R"({"error":"Invalid JSON data"})";
-            res.prepare_payload();
-            return res;
+            std::cerr << "Unknown option: " << arg << "\n";
+            return false;
         }
-    }
-
-    // get
-    if (req.method() == http::verb::get && req.target() == "/get") {
-        http::response<http::string_body> res{http::status::ok, req.version()};
-        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-        res.set(http::field::content_type, "application/json");
-
-        boost::json::object headers_json;
-        for (const auto& header : req.base()) {
-            headers_json[header.name_string()] = header.value();
+        if ( ! ok) {
+            std::cerr << "Invalid value: " << arg << "\n";
+            return false;
         }
-
-        boost::json::object response_body;
-        response_body["headers"] = headers_json;
-
-        res.body() = boost::json::serialize(response_body);
-        res.prepare_payload();
-        return res;
     }
-
-
-    // cookie.cpp
-    if (req.target().starts_with("/cookies/set?")) {
-        auto query = req.target().substr(13);
-
-        auto eq_pos = query.find("=");
-        auto cookie_name = query.substr(0, eq_pos);
-        auto cookie_value = query.substr(eq_pos + 1);
-
-        // Set the cookie
-        http::response<http::string_body> res{http::status::ok, req.version()};
-        res.set(http::field::set_cookie, std::string(cookie_name) + "=" + std::string(cookie_value));
-
-        res.result(http::status::ok);
-        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-        res.set(http::field::content_type, "application/json");
-        res.body() = R"({"cookies":{"cookie-1":"foo","cookie-2":"bar"}})";
-        res.prepare_payload();
-        return res;
-    }
-
-    if (req.target().starts_with("/cookies/delete?")) {
-        auto query = req.target().substr(16);
-
-        auto eq_pos = query.find("=");
-        auto cookie_name = query.substr(0, eq_pos);
-
-        http::response<http::string_body> res{http::status::ok, req.version()};
-        res.set(http::field::set_cookie, std::string(cookie_name) + "=; Max-Age=0");
-
-        res.result(http::status::ok);
-        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-        res.set(http::field::content_type, "application/json");
-        res.body() = R"({"deleted":")" + std::string(cookie_name) + R"("})";        //TODO: use body() +=   everywhere
-        res.prepare_payload();
-        return res;
-    }
-
-
-    if (req.target() == "/cookies") {
-        http::response<http::string_body> res{http::status::ok, req.version()};
-        res.result(http::status::ok);
-        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-        res.set(http::field::content_type, "application/json");
-        res.body() = R"({"cookies":{}})";
-        res.prepare_payload();
-        return res;
-    }
-    return not_found(req.target());
+    return true;
 }
 
-//------------------------------------------------------------------------------
-
-// net::awaitable<void> do_session(tcp_stream stream) {
-net::awaitable<void> do_session(tcp::socket socket) {
-
-    beast::flat_buffer buffer;
-
-    try {
-        for(;;) {
-            // stream.expires_after(std::chrono::seconds(30));
-
-            http::request<http::string_body> req;
-            // co_await http::async_read(stream, buffer, req);
-            co_await http::async_read(socket, buffer, req, net::use_awaitable);
-
-            http::message_generator msg = handle_request(std::move(req));
-            bool keep_alive = msg.keep_alive();
-            // co_await beast::async_write(stream, std::move(msg), net::use_awaitable);
-            co_await beast::async_write(socket, std::move(msg), net::use_awaitable);
-
-            if ( ! keep_alive) {
-                break;
-            }
-        }
-    } catch (boost::system::system_error & se) {
-        if (se.code() != http::error::end_of_stream) {
-            throw;
-        }
+std::vector<tcp::endpoint> resolve_upstream(net::io_context& ioc, std::string const& upstream) {
+    auto const colon = upstream.rfind(':');
+    if (colon == std::string::npos) {
+        throw std::invalid_argument("expected <host>:<port>");
     }
-
-    beast::error_code ec;
-    // stream.socket().shutdown(tcp::socket::shutdown_send, ec);
-    socket.shutdown(tcp::socket::shutdown_send, ec);
-}
-
-//------------------------------------------------------------------------------
-
-net::awaitable<void> do_listen(tcp::endpoint endpoint) {
-    auto acceptor = net::use_awaitable.as_default_on(tcp::acceptor(co_await net::this_coro::executor));
-    acceptor.open(endpoint.protocol());
-    acceptor.set_option(net::socket_base::reuse_address(true));
-    acceptor.bind(endpoint);
-    acceptor.listen(net::socket_base::max_listen_connections);
-
-    for(;;) {
-        boost::asio::co_spawn(
-            acceptor.get_executor(),
-                // do_session(tcp_stream(co_await acceptor.async_accept())),
-                do_session(co_await acceptor.async_accept()),
-                [](std::exception_ptr e) {
-                    if (e) {
-                        try {
-                            std::rethrow_exception(e);
-                        } catch (std::exception &e) {
-                            std::cerr << "Error in session: " << e.what() << "\n";
-                        }
-                    }
-                });
+    tcp::resolver resolver(ioc);
+    std::vector<tcp::endpoint> endpoints;
+    for (auto const& entry : resolver.resolve(upstream.substr(0, colon), upstream.substr(colon + 1))) {
+        endpoints.push_back(entry.endpoint());
     }
+    return endpoints;
 }
 
 int main(int argc, char* argv[]) {
-    if (argc != 4) {
+    server_options options;
+
+    if (argc < 4 || ! parse_options(argc, argv, options)) {
         std::cerr <<
-            "Usage: server <address> <port> <threads>\n" <<
+            "Usage: server <address> <port> <threads> [options]\n" <<
+            "Options:\n" <<
+            "    --scenario=<file>         JSON route definitions, reloaded on change or SIGHUP\n" <<
+            "    --cookie-sessions=<n>     Maximum number of cookie jar sessions (default 100000)\n" <<
+            "    --log-requests=<0|1>      Print every request target (default 1)\n" <<
+            "    --cache-control=<value>   Cache-Control for /image and seeded /bigfile (default no-cache)\n" <<
+            "    --upload-dir=<dir>        Where multipart uploads with ?sink=file are stored (default .)\n" <<
+            "    --max-lag-ms=<n>          Shed load when event loop lag stays above n ms (default 0, off)\n" <<
+            "    --max-in-flight=<n>       Upper bound on concurrently handled requests (default 10000)\n" <<
+            "    --retry-after=<s>         Retry-After sent with shed requests (default 1)\n" <<
+            "    --server-timing=<0|1>     Report per-phase timing in a Server-Timing header (default 0)\n" <<
+            "    --trace-sample=<n>        Keep a trace of every n-th request for /__trace (default 0, off)\n" <<
+            "    --socket-tuning=<0|1>     Per-route socket options; 1 applies the profiles below (default 0)\n" <<
+            "    --tcp-nodelay=<0|1>       TCP_NODELAY for small responses (default 1)\n" <<
+            "    --stream-sndbuf=<n>       SO_SNDBUF for streamed responses (default 262144, 0 leaves it)\n" <<
+            "    --stream-lowat=<n>        TCP_NOTSENT_LOWAT for streamed responses (default 16384, 0 leaves it)\n" <<
+            "    --stream-cork=<0|1>       Cork streamed headers and chunks into full segments (default 1)\n" <<
+            "    --clock-speedup=<x>       Run delays, shaping and timeouts x times faster (default 1)\n" <<
+            "    --workers=<n>             Run n worker processes under a master (default 0, one process)\n" <<
+            "    --drain-timeout=<s>       How long a stopping worker waits for its requests (default 30)\n" <<
+            "    --proxy=<host>:<port>     Forward connections to an upstream instead of serving HTTP\n" <<
+            "    --proxy-latency-ms=<n>    Delay added to each direction\n" <<
+            "    --proxy-jitter-ms=<n>     Random +-n ms on top of the latency, without reordering\n" <<
+            "    --proxy-bandwidth=<n>     Bytes per second per direction\n" <<
+            "    --proxy-chunk=<n>         Forward in writes of at most n bytes\n" <<
+            "    --proxy-reset-rate=<p>    Probability that a connection is reset midway (0-1)\n" <<
+            "    --proxy-seed=<n>          Seed for jitter and resets, the same for every run (default random)\n" <<
             "Example:\n" <<
             "    server 0.0.0.0 8080 1\n";
         return EXIT_FAILURE;
@@ -597,19 +357,82 @@ int main(int argc, char* argv[]) {
     auto const address = net::ip::make_address(argv[1]);
     auto const port = static_cast<unsigned short>(std::atoi(argv[2]));
     auto const threads = std::max<int>(1, std::atoi(argv[3]));
+    virtual_clock::set_speedup(options.clock_speedup);
+
+    // Started by a prefork master as one of its workers, or asked to be a
+    // master: the master serves nothing itself.
+    int listen_fd = -1;
+    std::optional<prefork::worker_context> worker;
+#if defined(__linux__)
+    worker = prefork::worker_from_environment();
+    if (worker) {
+        listen_fd = worker->listen_fd;
+    } else if (options.prefork.workers > 0) {
+        try {
+            prefork::master master(argc, argv, tcp::endpoint{address, port}, options.prefork, ! options.scenario_file.empty());
+            return master.run();
+        } catch (std::exception& e) {
+            std::cerr << "Error in master: " << e.what() << "\n";
+            return EXIT_FAILURE;
+        }
+    }
+#else
+    if (options.prefork.workers > 0) {
+        std::cerr << "--workers is only supported on Linux\n";
+        return EXIT_FAILURE;
+    }
+#endif
 
     net::io_context ioc{threads};
 
-    boost::asio::co_spawn(ioc, do_listen(tcp::endpoint{address, port}), [](std::exception_ptr e) {
-        if (e) {
-            try {
-                std::rethrow_exception(e);
-            } catch(std::exception & e) {
-                std::cerr << "Error in acceptor: " << e.what() << "\n";
-            }
+    if (options.proxy.enabled()) {
+        try {
+            options.proxy.upstream_endpoints = resolve_upstream(ioc, options.proxy.upstream);
+        } catch (std::exception& e) {
+            std::cerr << "Cannot resolve upstream " << options.proxy.upstream << ": " << e.what() << "\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    server_state state{std::move(options), ioc.get_executor(), static_cast<size_t>(threads)};
+    state.payload.register_with(ioc);
+    if (worker) {
+        state.worker = worker->slot;
+        state.workers = worker->stats;
+    }
+
+    if ( ! state.options.scenario_file.empty()) {
+        try {
+            state.scenarios.publish(scenario::load(state.options.scenario_file));
+        } catch (std::exception& e) {
+            std::cerr << "Error loading scenario: " << e.what() << "\n";
+            return EXIT_FAILURE;
         }
+    }
+
+    boost::asio::co_spawn(net::make_strand(ioc), do_listen(tcp::endpoint{address, port}, state, ioc, listen_fd), [](std::exception_ptr e) {
+        log_exception("acceptor", e);
+    });
+
+    boost::asio::co_spawn(ioc, do_expire_cookies(state), [](std::exception_ptr e) {
+        log_exception("cookie expiry", e);
     });
 
+    if (state.admission.enabled()) {
+        boost::asio::co_spawn(ioc, do_measure_lag(state), [](std::exception_ptr e) {
+            log_exception("lag probe", e);
+        });
+    }
+
+    if ( ! state.options.scenario_file.empty()) {
+        boost::asio::co_spawn(ioc, do_watch_scenario(state), [](std::exception_ptr e) {
+            log_exception("scenario watcher", e);
+        });
+        boost::asio::co_spawn(ioc, do_reload_on_sighup(state), [](std::exception_ptr e) {
+            log_exception("scenario watcher", e);
+        });
+    }
+
     std::vector<std::thread> v;
     v.reserve(threads - 1);
     for(auto i = threads - 1; i > 0; --i) {
@@ -618,6 +441,16 @@ int main(int argc, char* argv[]) {
         });
     }
     ioc.run();
+    for (auto& t : v) {
+        t.join();
+    }
 
+    if (state.worker) {
+        // A drained worker: sessions that were still open hold references
+        // into state, so leave without unwinding them.
+        state.worker->pid.store(0, std::memory_order_relaxed);
+        std::cout.flush();
+        std::exit(EXIT_SUCCESS);
+    }
     return 0;
 }
@@ -0,0 +1,445 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include <unistd.h>
+
+#include <boost/crc.hpp>
+#include <boost/json.hpp>
+
+// Incremental multipart/form-data parsing (RFC 7578).
+//
+// The body is fed in whatever pieces the socket delivers and never held in
+// full: part payloads go straight to a part_sink, and the parser only keeps
+// up to one delimiter's worth of bytes that might be the start of the next
+// boundary, plus the headers of the part being opened.
+//
+// Delimiters ("\r\n--" + boundary) are found with Boyer-Moore-Horspool, which
+// skips ahead by up to the delimiter length on a mismatch. A delimiter that
+// straddles two pieces is found by searching the held-back tail together with
+// the first bytes of the next piece.
+
+namespace multipart {
+
+class error : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// The boundary parameter of a multipart/form-data Content-Type, if it is one.
+inline std::optional<std::string> boundary_of(std::string_view content_type) {
+    auto const semi = content_type.find(';');
+    auto type = content_type.substr(0, semi);
+    while ( ! type.empty() && type.back() == ' ') {
+        type.remove_suffix(1);
+    }
+    if (type.size() != 19 || ! std::equal(type.begin(), type.end(), "multipart/form-data", [](char a, char b) {
+            return std::tolower(static_cast<unsigned char>(a)) == b;
+        })) {
+        return std::nullopt;
+    }
+
+    auto params = semi == std::string_view::npos ? std::string_view{} : content_type.substr(semi + 1);
+    while ( ! params.empty()) {
+        auto const next = params.find(';');
+        auto param = params.substr(0, next);
+        params = next == std::string_view::npos ? std::string_view{} : params.substr(next + 1);
+
+        while ( ! param.empty() && param.front() == ' ') {
+            param.remove_prefix(1);
+        }
+        auto const eq = param.find('=');
+        if (eq == std::string_view::npos) {
+            continue;
+        }
+        auto name = param.substr(0, eq);
+        if (name.size() != 8 || ! std::equal(name.begin(), name.end(), "boundary", [](char a, char b) {
+                return std::tolower(static_cast<unsigned char>(a)) == b;
+            })) {
+            continue;
+        }
+        auto value = param.substr(eq + 1);
+        if (value.size() >= 2 && value.front() == '"' && value.back() == '"') {
+            value = value.substr(1, value.size() - 2);
+        }
+        if (value.empty() || value.size() > 70) {
+            return std::nullopt;
+        }
+        return std::string(value);
+    }
+    return std::nullopt;
+}
+
+// Boyer-Moore-Horspool search for a fixed pattern.
+class horspool {
+public:
+    explicit horspool(std::string pattern)
+        : pattern_(std::move(pattern))
+    {
+        skip_.fill(pattern_.size());
+        for (std::size_t i = 0; i + 1 < pattern_.size(); ++i) {
+            skip_[static_cast<unsigned char>(pattern_[i])] = pattern_.size() - 1 - i;
+        }
+    }
+
+    std::string const& pattern() const {
+        return pattern_;
+    }
+
+    std::size_t find(std::string_view haystack) const {
+        auto const m = pattern_.size();
+        if (haystack.size() < m) {
+            return std::string_view::npos;
+        }
+        auto const last = static_cast<unsigned char>(pattern_[m - 1]);
+        for (std::size_t i = 0; i + m <= haystack.size();) {
+            auto const c = static_cast<unsigned char>(haystack[i + m - 1]);
+            if (c == last && std::memcmp(haystack.data() + i, pattern_.data(), m - 1) == 0) {
+                return i;
+            }
+            i += skip_[c];
+        }
+        return std::string_view::npos;
+    }
+
+private:
+    std::string pattern_;
+    std::array<std::size_t, 256> skip_;
+};
+
+struct part_info {
+    std::string name;
+    std::string filename;
+    std::string content_type;
+};
+
+// Where part payloads go. Every mode counts bytes; hash and file also keep a
+// CRC-32 of the payload.
+class part_sink {
+public:
+    enum class mode {
+        discard,
+        hash,
+        file,
+    };
+
+    part_sink(mode m, std::filesystem::path directory = {})
+        : mode_(m)
+        , directory_(std::move(directory))
+    {}
+
+    void begin(part_info const& info) {
+        size_ = 0;
+        crc_.reset();
+        path_.clear();
+        if (mode_ == mode::file) {
+            path_ = directory_ / file_name(info);
+            file_.open(path_, std::ios::binary | std::ios::trunc);
+            if ( ! file_) {
+                throw error("cannot create " + path_.string());
+            }
+        }
+    }
+
+    void write(std::string_view data) {
+        size_ += data.size();
+        if (mode_ != mode::discard) {
+            crc_.process_bytes(data.data(), data.size());
+        }
+        if (mode_ == mode::file) {
+            file_.write(data.data(), static_cast<std::streamsize>(data.size()));
+        }
+    }
+
+    void finish(boost::json::object& summary) {
+        summary["size"] = size_;
+        if (mode_ != mode::discard) {
+            char buf[16];
+            std::snprintf(buf, sizeof(buf), "%08x", static_cast<unsigned>(crc_.checksum()));
+            summary["crc32"] = buf;
+        }
+        if (mode_ == mode::file) {
+            file_.close();
+            if ( ! file_) {
+                throw error("cannot write " + path_.string());
+            }
+            summary["path"] = path_.string();
+        }
+    }
+
+private:
+    // A unique name that keeps the client's file name for readability, minus
+    // anything that could leave the upload directory. The pid and a random
+    // tag drawn at startup keep prefork workers and restarted servers from
+    // reusing each other's names: "<pid>-<tag>-<n>-<name>".
+    static std::string file_name(part_info const& info) {
+        static std::string const prefix = [] {
+            std::random_device rd;
+            char buf[48];
+            std::snprintf(buf, sizeof(buf), "%ld-%08x%08x-", static_cast<long>(::getpid()), rd(), rd());
+            return std::string(buf);
+        }();
+        static std::atomic<std::uint64_t> counter{0};
+        std::string name = prefix + std::to_string(counter.fetch_add(1, std::memory_order_relaxed)) + "-";
+        for (char const c : info.filename.empty() ? info.name : info.filename) {
+            name += std::isalnum(static_cast<unsigned char>(c)) || c == '.' || c == '-' || c == '_' ? c : '_';
+        }
+        return name;
+    }
+
+    mode mode_;
+    std::filesystem::path directory_;
+    std::uint64_t size_ = 0;
+    boost::crc_32_type crc_;
+    std::filesystem::path path_;
+    std::ofstream file_;
+};
+
+class parser {
+public:
+    static constexpr std::size_t max_header_bytes = 16 * 1024;
+
+    parser(std::string const& boundary, part_sink& sink)
+        : delimiter_("\r\n--" + boundary)
+        , sink_(sink)
+    {
+        // The first delimiter may open the body without a preceding CRLF;
+        // pretend there was one.
+        held_ = "\r\n";
+    }
+
+    // Consumes the next piece of the body.
+    void feed(std::string_view data) {
+        while ( ! data.empty()) {
+            switch (state_) {
+            case state::preamble:
+            case state::body:
+                data = scan_body(data);
+                break;
+            case state::after_delimiter:
+                data = after_delimiter(data);
+                break;
+            case state::headers:
+                data = headers(data);
+                break;
+            case state::epilogue:
+                return;
+            }
+        }
+    }
+
+    // Call at the end of the body; throws if the closing delimiter was missing.
+    boost::json::array finish() {
+        if (state_ != state::epilogue) {
+            throw error("multipart body ended before its closing boundary");
+        }
+        return std::move(parts_);
+    }
+
+private:
+    enum class state {
+        preamble,
+        body,
+        after_delimiter,
+        headers,
+        epilogue,
+    };
+
+    void emit(std::string_view data) {
+        if (state_ == state::body && ! data.empty()) {
+            sink_.write(data);
+        }
+    }
+
+    void on_delimiter() {
+        if (state_ == state::body) {
+            sink_.finish(current_);
+            parts_.push_back(std::move(current_));
+            current_ = {};
+        }
+        state_ = state::after_delimiter;
+        line_.clear();
+    }
+
+    std::string_view scan_body(std::string_view data) {
+        auto const m = delimiter_.pattern().size();
+
+        // A piece shorter than a delimiter: hold it back with the rest.
+        if (held_.size() + data.size() < m) {
+            held_.append(data);
+            return {};
+        }
+
+        // A delimiter starting in the held-back bytes ends within the first
+        // m - 1 bytes of this piece.
+        if ( ! held_.empty()) {
+            auto const take = std::min(data.size(), m - 1);
+            std::string joint = held_;
+            joint.append(data.substr(0, take));
+            auto const pos = delimiter_.find(joint);
+            if (pos != std::string_view::npos && pos < held_.size()) {
+                emit(std::string_view(joint).substr(0, pos));
+                auto const used = pos + m - held_.size();
+                held_.clear();
+                on_delimiter();
+                return data.substr(used);
+            }
+            if (data.size() < m - 1) {
+                // Not enough new bytes to rule the held ones out: keep the
+                // last m - 1 bytes and emit the rest.
+                emit(std::string_view(joint).substr(0, joint.size() - (m - 1)));
+                held_ = joint.substr(joint.size() - (m - 1));
+                return {};
+            }
+            emit(held_);
+            held_.clear();
+        }
+
+        auto const pos = delimiter_.find(data);
+        if (pos != std::string_view::npos) {
+            emit(data.substr(0, pos));
+            on_delimiter();
+            return data.substr(pos + m);
+        }
+        emit(data.substr(0, data.size() - (m - 1)));
+        held_.assign(data.substr(data.size() - (m - 1)));
+        return {};
+    }
+
+    // After a delimiter: "--" closes the body, otherwise optional whitespace
+    // and a CRLF open the next part.
+    std::string_view after_delimiter(std::string_view data) {
+        while ( ! data.empty()) {
+            line_ += data.front();
+            data.remove_prefix(1);
+
+            if (line_ == "--") {
+                state_ = state::epilogue;
+                return {};
+            }
+            if (line_.size() >= 2 && line_.ends_with("\r\n")) {
+                // The header block is searched for starting with this CRLF,
+                // so a part with no headers at all ends it immediately.
+                state_ = state::headers;
+                line_ = "\r\n";
+                return data;
+            }
+            if (line_.size() > 256 || (line_.back() != ' ' && line_.back() != '\t' && line_.back() != '\r' && line_ != "-")) {
+                throw error("malformed multipart boundary line");
+            }
+        }
+        return data;
+    }
+
+    std::string_view headers(std::string_view data) {
+        auto const before = line_.size();
+        line_.append(data.substr(0, max_header_bytes + 4 - std::min(before, max_header_bytes + 4)));
+        auto const end = line_.find("\r\n\r\n", before - std::min<std::size_t>(before, 3));
+        if (end == std::string::npos) {
+            if (line_.size() > max_header_bytes) {
+                throw error("multipart part headers too large");
+            }
+            return {};
+        }
+
+        auto const used = end + 4 - before;
+        return open_part(parse_headers(std::string_view(line_).substr(0, end + 2)), data.substr(used));
+    }
+
+    std::string_view open_part(part_info const& info, std::string_view rest) {
+        line_.clear();
+        current_ = {};
+        current_["name"] = info.name;
+        if ( ! info.filename.empty()) {
+            current_["filename"] = info.filename;
+        }
+        if ( ! info.content_type.empty()) {
+            current_["content_type"] = info.content_type;
+        }
+        sink_.begin(info);
+        state_ = state::body;
+        return rest;
+    }
+
+    // Content-Disposition: form-data; name="field"; filename="a.bin"
+    static part_info parse_headers(std::string_view block) {
+        part_info info;
+        while ( ! block.empty()) {
+            auto const eol = block.find("\r\n");
+            auto line = block.substr(0, eol);
+            block = eol == std::string_view::npos ? std::string_view{} : block.substr(eol + 2);
+
+            auto const colon = line.find(':');
+            if (colon == std::string_view::npos) {
+                continue;
+            }
+            auto const name = lower(line.substr(0, colon));
+            auto value = line.substr(colon + 1);
+            while ( ! value.empty() && value.front() == ' ') {
+                value.remove_prefix(1);
+            }
+
+            if (name == "content-type") {
+                info.content_type = value;
+            } else if (name == "content-disposition") {
+                info.name = disposition_param(value, "name");
+                info.filename = disposition_param(value, "filename");
+            }
+        }
+        return info;
+    }
+
+    static std::string disposition_param(std::string_view value, std::string_view key) {
+        while ( ! value.empty()) {
+            auto const semi = value.find(';');
+            auto param = value.substr(0, semi);
+            value = semi == std::string_view::npos ? std::string_view{} : value.substr(semi + 1);
+
+            while ( ! param.empty() && param.front() == ' ') {
+                param.remove_prefix(1);
+            }
+            auto const eq = param.find('=');
+            if (eq == std::string_view::npos || lower(param.substr(0, eq)) != key) {
+                continue;
+            }
+            auto v = param.substr(eq + 1);
+            if (v.size() >= 2 && v.front() == '"' && v.back() == '"') {
+                v = v.substr(1, v.size() - 2);
+            }
+            return std::string(v);
+        }
+        return {};
+    }
+
+    static std::string lower(std::string_view s) {
+        std::string out(s);
+        for (auto& c : out) {
+            c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        }
+        return out;
+    }
+
+    horspool delimiter_;
+    part_sink& sink_;
+    state state_ = state::preamble;
+    std::string held_;
+    std::string line_;
+    boost::json::object current_;
+    boost::json::array parts_;
+};
+
+} // namespace multipart
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <random>
+#include <vector>
+
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/io_context.hpp>
+
+#if defined(BOOST_ASIO_HAS_IO_URING)
+#include <boost/asio/registered_buffer.hpp>
+#endif
+
+// A block of pseudo-random bytes generated once at startup and shared by every
+// generated download. /bigfile chunks are slices of it taken at random
+// offsets, so streaming costs no per-byte generation and no per-request
+// buffer.
+//
+// With the io_uring backend the block is registered with the io_context, and
+// writes from it go out as fixed-buffer operations: the kernel pins the pages
+// once instead of on every send.
+
+namespace net = boost::asio;
+
+class payload_pool {
+public:
+    static constexpr std::size_t pool_size = std::size_t(4) << 20;
+    static constexpr std::uint64_t seed = 0x5eed;
+
+    payload_pool()
+        : data_(pool_size)
+    {
+        std::mt19937_64 gen(seed);
+        for (std::size_t i = 0; i < data_.size(); i += 8) {
+            auto const word = gen();
+            for (std::size_t b = 0; b < 8; ++b) {
+                data_[i + b] = static_cast<std::uint8_t>(word >> (8 * b));
+            }
+        }
+    }
+
+    payload_pool(payload_pool const&) = delete;
+    payload_pool& operator=(payload_pool const&) = delete;
+
+    void register_with(net::io_context& ioc) {
+#if defined(BOOST_ASIO_HAS_IO_URING)
+        registration_.emplace(net::register_buffers(ioc, buffers_type{net::buffer(data_)}));
+#else
+        (void)ioc;
+#endif
+    }
+
+    // A random starting offset for a slice of n bytes, n <= pool_size.
+    template <typename Generator>
+    static std::size_t random_offset(Generator& gen, std::size_t n) {
+        std::uniform_int_distribution<std::size_t> distrib(0, pool_size - n);
+        return distrib(gen);
+    }
+
+    net::const_buffer slice(std::size_t offset, std::size_t n) const {
+        return net::buffer(data_.data() + offset, n);
+    }
+
+#if defined(BOOST_ASIO_HAS_IO_URING)
+    bool registered() const {
+        return registration_.has_value();
+    }
+
+    net::const_registered_buffer registered_slice(std::size_t offset, std::size_t n) const {
+        return net::buffer(net::const_registered_buffer((*registration_)[0]) + offset, n);
+    }
+#endif
+
+private:
+    std::vector<std::uint8_t> data_;
+
+#if defined(BOOST_ASIO_HAS_IO_URING)
+    using buffers_type = std::vector<net::mutable_buffer>;
+    std::optional<net::buffer_registration<buffers_type>> registration_;
+#endif
+};
@@ -0,0 +1,407 @@
+#pragma once
+
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/signal_set.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/use_awaitable.hpp>
+
+#if defined(__linux__)
+#include <csignal>
+#include <fcntl.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "shared_stats.hpp"
+
+// Prefork mode: a master process that owns the listening socket and runs
+// --workers copies of the server, each a separate process with its own
+// io_context and threads, all accepting on the inherited socket.
+//
+// Workers are the server binary exec'd again with the listener and the
+// shared stats segment passed as inherited descriptors in the environment,
+// so a worker starts from a clean process image. A worker that dies is
+// started again in its slot (after a second if it died right away).
+//
+// SIGTERM or SIGINT to the master drains: workers stop accepting and exit
+// once their in-flight requests are done, or after --drain-timeout.
+//
+// SIGUSR2 is a rolling restart: the master execs the binary at its original
+// path, which may by now be an upgraded build, as a new master that inherits
+// the listener and the stats. The new master starts its workers, waits until
+// they are accepting, and then tells the old master to drain. Throughout,
+// some process is accepting on the socket, so clients see no refused
+// connections. As with any re-exec upgrade, the new master is not a child of
+// whatever started the old one. A master ignores SIGUSR2 until the master it
+// took over from has exited.
+
+namespace net = boost::asio;
+
+using tcp = boost::asio::ip::tcp;
+
+struct prefork_options {
+    std::size_t workers = 0;                    // 0 runs a single process
+    std::chrono::seconds drain_timeout{30};
+};
+
+namespace prefork {
+
+// What a master hands down, in the environment.
+constexpr char const* listen_fd_env = "SERVER_LISTEN_FD";
+constexpr char const* stats_fd_env = "SERVER_STATS_FD";
+constexpr char const* worker_slot_env = "SERVER_WORKER_SLOT";
+constexpr char const* upgrade_from_env = "SERVER_UPGRADE_FROM";
+
+inline std::optional<long> env_number(char const* name) {
+    auto const* value = std::getenv(name);
+    if ( ! value || ! *value) {
+        return std::nullopt;
+    }
+    char* end = nullptr;
+    auto const n = std::strtol(value, &end, 10);
+    if (*end != '\0') {
+        return std::nullopt;
+    }
+    return n;
+}
+
+struct worker_context {
+    int listen_fd;
+    shared_stats::segment* stats;
+    shared_stats::worker_slot* slot;
+};
+
+#if defined(__linux__)
+
+// Set in a process started by a master as one of its workers.
+inline std::optional<worker_context> worker_from_environment() {
+    auto const slot = env_number(worker_slot_env);
+    auto const listen_fd = env_number(listen_fd_env);
+    auto stats_fd = env_number(stats_fd_env);
+    if ( ! slot || ! listen_fd || ! stats_fd || *slot < 0 || *slot >= static_cast<long>(2 * shared_stats::segment::max_workers)) {
+        return std::nullopt;
+    }
+    int fd = static_cast<int>(*stats_fd);
+    auto* stats = shared_stats::map(fd);
+    auto* s = &stats->slots[*slot];
+    s->started.fetch_add(1, std::memory_order_relaxed);
+    return worker_context{static_cast<int>(*listen_fd), stats, s};
+}
+
+class master {
+public:
+    master(int argc, char* argv[], tcp::endpoint endpoint, prefork_options options, bool forward_sighup)
+        : argv_(argv, argv + argc)
+        , options_(options)
+        , forward_sighup_(forward_sighup)
+        , signals_(ioc_, SIGCHLD, SIGTERM, SIGINT)
+        , workers_(options.workers, 0)
+        , started_at_(options.workers)
+    {
+        argv_.push_back(nullptr);
+
+        // The path the binary was started from, resolved now: after an
+        // upgrade replaces the file, it names the new build.
+        char self[4096];
+        auto const n = ::readlink("/proc/self/exe", self, sizeof(self) - 1);
+        self_ = n > 0 ? std::string(self, static_cast<std::size_t>(n)) : std::string(argv[0]);
+
+        signals_.add(SIGHUP);
+        signals_.add(SIGUSR1);
+        signals_.add(SIGUSR2);
+
+        if (auto const fd = env_number(listen_fd_env)) {
+            listen_fd_ = static_cast<int>(*fd);
+        } else {
+            tcp::acceptor acceptor(ioc_);
+            acceptor.open(endpoint.protocol());
+            acceptor.set_option(net::socket_base::reuse_address(true));
+            acceptor.bind(endpoint);
+            acceptor.listen(net::socket_base::max_listen_connections);
+            listen_fd_ = acceptor.release();
+        }
+        inherit(listen_fd_);
+
+        stats_fd_ = static_cast<int>(env_number(stats_fd_env).value_or(-1));
+        stats_ = shared_stats::map(stats_fd_);
+        inherit(stats_fd_);
+        generation_ = stats_->generation.fetch_add(1, std::memory_order_relaxed) + 1;
+
+        if (auto const pid = env_number(upgrade_from_env)) {
+            predecessor_ = static_cast<pid_t>(*pid);
+        }
+        ::unsetenv(upgrade_from_env);
+    }
+
+    int run() {
+        for (std::size_t i = 0; i < workers_.size(); ++i) {
+            spawn(i);
+        }
+        std::cout << "Master " << ::getpid() << ": " << workers_.size() << " workers, generation " << generation_ << "\n";
+
+        net::co_spawn(ioc_, handle_signals(), net::detached);
+        if (predecessor_ != 0) {
+            net::co_spawn(ioc_, take_over(), net::detached);
+        }
+        ioc_.run();
+
+        auto const t = shared_stats::sum(*stats_);
+        std::cout << "Master " << ::getpid() << " exiting: " << t.connections << " connections, " << t.requests << " requests\n";
+        return EXIT_SUCCESS;
+    }
+
+private:
+    static void inherit(int fd) {
+        auto const flags = ::fcntl(fd, F_GETFD);
+        ::fcntl(fd, F_SETFD, flags & ~FD_CLOEXEC);
+    }
+
+    shared_stats::worker_slot& slot(std::size_t index) {
+        return stats_->slot(generation_, index);
+    }
+
+    // fork + exec of the server binary. Signals stay blocked across the
+    // fork, so none reaches asio's handler in the child before exec.
+    template <typename Setup>
+    pid_t exec_self(Setup&& setup) {
+        sigset_t all;
+        sigset_t old;
+        sigfillset(&all);
+        std::cout.flush();
+        ::sigprocmask(SIG_BLOCK, &all, &old);
+
+        auto const pid = ::fork();
+        if (pid == 0) {
+            for (int sig : {SIGCHLD, SIGTERM, SIGINT, SIGHUP, SIGUSR1, SIGUSR2}) {
+                ::signal(sig, SIG_DFL);
+            }
+            setup();
+            ::sigprocmask(SIG_SETMASK, &old, nullptr);
+            ::execv(self_.c_str(), argv_.data());
+            std::cerr << "Cannot exec " << self_ << ": " << std::strerror(errno) << "\n";
+            ::_exit(127);
+        }
+        ::sigprocmask(SIG_SETMASK, &old, nullptr);
+        if (pid < 0) {
+            throw std::system_error(errno, std::generic_category(), "fork");
+        }
+        return pid;
+    }
+
+    void spawn(std::size_t index) {
+        auto const absolute = static_cast<std::size_t>(&slot(index) - stats_->slots);
+        auto const parent = ::getpid();
+        workers_[index] = exec_self([&] {
+            // A worker should not outlive its master.
+            ::prctl(PR_SET_PDEATHSIG, SIGTERM);
+            if (::getppid() != parent) {
+                ::_exit(1);
+            }
+            ::setenv(worker_slot_env, std::to_string(absolute).c_str(), 1);
+            ::setenv(listen_fd_env, std::to_string(listen_fd_).c_str(), 1);
+            ::setenv(stats_fd_env, std::to_string(stats_fd_).c_str(), 1);
+        });
+        slot(index).generation.store(generation_, std::memory_order_relaxed);
+        started_at_[index] = std::chrono::steady_clock::now();
+    }
+
+    void upgrade() {
+        if (successor_ != 0 || stopping_) {
+            return;
+        }
+        // Generations alternate between the two halves of the stats slots,
+        // so a successor would reuse the ones our predecessor's workers are
+        // still draining in.
+        if (predecessor_ != 0 && (::kill(predecessor_, 0) == 0 || errno != ESRCH)) {
+            std::cerr << "Master " << ::getpid() << ": not upgrading, " << predecessor_ << " is still draining\n";
+            return;
+        }
+        auto const self = ::getpid();
+        successor_ = exec_self([&] {
+            ::setenv(listen_fd_env, std::to_string(listen_fd_).c_str(), 1);
+            ::setenv(stats_fd_env, std::to_string(stats_fd_).c_str(), 1);
+            ::setenv(upgrade_from_env, std::to_string(self).c_str(), 1);
+        });
+        std::cout << "Master " << self << ": starting " << self_ << " as pid " << successor_ << "\n";
+    }
+
+    // After a rolling restart: once every new worker is accepting, the old
+    // master may drain.
+    net::awaitable<void> take_over() {
+        net::steady_timer timer(ioc_);
+        auto const deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        for(;;) {
+            bool ready = true;
+            for (std::size_t i = 0; i < workers_.size(); ++i) {
+                ready = ready && slot(i).pid.load(std::memory_order_relaxed) == workers_[i];
+            }
+            if (ready || std::chrono::steady_clock::now() >= deadline) {
+                break;
+            }
+            timer.expires_after(std::chrono::milliseconds(50));
+            co_await timer.async_wait(net::use_awaitable);
+        }
+        std::cout << "Master " << ::getpid() << ": taking over from " << predecessor_ << "\n";
+        ::kill(predecessor_, SIGTERM);
+    }
+
+    void stop() {
+        if (stopping_) {
+            return;
+        }
+        stopping_ = true;
+        signal_workers(SIGTERM);
+        if (live_workers() == 0) {
+            ioc_.stop();
+            return;
+        }
+        net::co_spawn(ioc_, kill_stragglers(), net::detached);
+    }
+
+    // Workers give up on their requests after the drain timeout; one that
+    // is stuck past that is killed.
+    net::awaitable<void> kill_stragglers() {
+        net::steady_timer timer(ioc_, options_.drain_timeout + std::chrono::seconds(5));
+        co_await timer.async_wait(net::use_awaitable);
+        signal_workers(SIGKILL);
+    }
+
+    void signal_workers(int sig) {
+        for (auto const pid : workers_) {
+            if (pid != 0) {
+                ::kill(pid, sig);
+            }
+        }
+    }
+
+    std::size_t live_workers() const {
+        std::size_t n = 0;
+        for (auto const pid : workers_) {
+            n += pid != 0;
+        }
+        return n;
+    }
+
+    net::awaitable<void> respawn_later(std::size_t index) {
+        net::steady_timer timer(ioc_, std::chrono::seconds(1));
+        co_await timer.async_wait(net::use_awaitable);
+        if ( ! stopping_) {
+            spawn(index);
+        }
+    }
+
+    void reap() {
+        int status = 0;
+        pid_t pid;
+        while ((pid = ::waitpid(-1, &status, WNOHANG)) > 0) {
+            if (pid == successor_) {
+                std::cerr << "Master " << ::getpid() << ": upgrade failed, new master exited\n";
+                successor_ = 0;
+                continue;
+            }
+            for (std::size_t i = 0; i < workers_.size(); ++i) {
+                if (workers_[i] != pid) {
+                    continue;
+                }
+                workers_[i] = 0;
+                slot(i).pid.store(0, std::memory_order_relaxed);
+                if (stopping_) {
+                    break;
+                }
+
+                stats_->crashes.fetch_add(1, std::memory_order_relaxed);
+                std::cerr << "Worker " << i << " (pid " << pid << ") ";
+                if (WIFSIGNALED(status)) {
+                    std::cerr << "killed by signal " << WTERMSIG(status);
+                } else {
+                    std::cerr << "exited with status " << WEXITSTATUS(status);
+                }
+                std::cerr << "; restarting\n";
+
+                // One that dies right away would otherwise be restarted in a
+                // tight loop.
+                if (std::chrono::steady_clock::now() - started_at_[i] < std::chrono::seconds(1)) {
+                    net::co_spawn(ioc_, respawn_later(i), net::detached);
+                } else {
+                    spawn(i);
+                }
+                break;
+            }
+        }
+        if (stopping_ && live_workers() == 0) {
+            ioc_.stop();
+        }
+    }
+
+    void print_stats() {
+        auto const t = shared_stats::sum(*stats_);
+        std::cout << "Master " << ::getpid() << ": " << t.live_workers << " live workers, " << t.started << " started, "
+                  << stats_->crashes.load(std::memory_order_relaxed) << " crashed, " << t.connections << " connections, "
+                  << t.requests << " requests\n";
+    }
+
+    net::awaitable<void> handle_signals() {
+        for(;;) {
+            auto const sig = co_await signals_.async_wait(net::use_awaitable);
+            switch (sig) {
+            case SIGCHLD:
+                reap();
+                break;
+            case SIGTERM:
+            case SIGINT:
+                stop();
+                break;
+            case SIGHUP:
+                // Workers reload their scenario on SIGHUP; without one it
+                // would terminate them.
+                if (forward_sighup_) {
+                    signal_workers(SIGHUP);
+                }
+                break;
+            case SIGUSR1:
+                print_stats();
+                break;
+            case SIGUSR2:
+                upgrade();
+                break;
+            }
+        }
+    }
+
+    std::vector<char*> argv_;
+    prefork_options options_;
+    bool forward_sighup_;
+    net::io_context ioc_;
+    net::signal_set signals_;
+    std::string self_;
+    int listen_fd_ = -1;
+    int stats_fd_ = -1;
+    shared_stats::segment* stats_ = nullptr;
+    std::uint32_t generation_ = 0;
+    std::vector<pid_t> workers_;
+    std::vector<std::chrono::steady_clock::time_point> started_at_;
+    pid_t predecessor_ = 0;
+    pid_t successor_ = 0;
+    bool stopping_ = false;
+};
+
+#endif
+
+} // namespace prefork
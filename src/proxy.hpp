@@ -0,0 +1,418 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/connect.hpp>
+#include <boost/asio/experimental/awaitable_operators.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/redirect_error.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/write.hpp>
+
+#if defined(__linux__)
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "recycling_pool.hpp"
+#include "timing_wheel.hpp"
+#include "virtual_clock.hpp"
+
+// Proxy mode: every accepted connection is forwarded to an upstream, with
+// latency, jitter, a bandwidth cap, re-chunking and connection resets
+// injected on the way.
+//
+// Each direction is shaped independently. A reader queues what it receives,
+// stamped with the time it may leave (now + latency +- jitter, never earlier
+// than the segment before it, so jitter does not reorder bytes), and a writer
+// sends each segment when it is due: in pieces of at most chunk bytes, paced
+// to the bandwidth. Up to max_queued_bytes wait per direction before the
+// reader stops reading and TCP flow control pushes back on the sender.
+//
+// With no shaping configured nothing needs to be held back, and on Linux the
+// bytes go socket -> pipe -> socket with splice(2) without being copied
+// through user space.
+//
+// A connection chosen for a reset (with probability reset_rate) is aborted
+// with an RST on both sides after a random number of bytes, up to
+// reset_window, has been forwarded.
+//
+// Latency and pacing run on virtual_clock. With a seed, the n-th connection
+// since startup draws the same jitter, per direction, and reset point on every
+// run.
+
+namespace net = boost::asio;
+
+using tcp = boost::asio::ip::tcp;
+
+struct proxy_options {
+    std::string upstream;                   // host:port; empty when not proxying
+    std::vector<tcp::endpoint> upstream_endpoints;
+    std::chrono::milliseconds latency{0};
+    std::chrono::milliseconds jitter{0};
+    std::size_t bandwidth_bytes_per_sec = 0;
+    std::size_t chunk_size = 0;
+    double reset_rate = 0;
+    std::size_t reset_window = 64 * 1024;
+    std::size_t max_queued_bytes = 4 << 20;
+    std::optional<std::uint64_t> seed;
+
+    bool enabled() const {
+        return ! upstream.empty();
+    }
+
+    bool shaped() const {
+        return latency.count() > 0 || jitter.count() > 0 || bandwidth_bytes_per_sec != 0 || chunk_size != 0;
+    }
+};
+
+namespace proxy {
+
+using clock = virtual_clock;
+
+// A connection's generators. Each direction draws its jitter from its own, so
+// how the two directions' reads interleave does not change either sequence.
+enum class stream : std::uint32_t { reset, to_upstream, to_downstream };
+
+inline std::mt19937 make_generator(proxy_options const& options, std::uint64_t n, stream s) {
+    if ( ! options.seed) {
+        return std::mt19937(std::random_device{}());
+    }
+    std::seed_seq seq{
+        static_cast<std::uint32_t>(*options.seed), static_cast<std::uint32_t>(*options.seed >> 32),
+        static_cast<std::uint32_t>(n), static_cast<std::uint32_t>(n >> 32), static_cast<std::uint32_t>(s)};
+    return std::mt19937(seq);
+}
+
+inline std::uint64_t next_connection() {
+    static std::atomic<std::uint64_t> connections{0};
+    return connections.fetch_add(1, std::memory_order_relaxed);
+}
+
+struct connection {
+    tcp::socket downstream;
+    tcp::socket upstream;
+    proxy_options const& options;
+    timing_wheel_service& timers;
+    std::uint64_t const index;
+    std::mt19937 to_upstream;
+    std::mt19937 to_downstream;
+    std::optional<std::size_t> reset_at;
+    std::size_t forwarded = 0;
+
+    connection(tcp::socket down, tcp::socket up, proxy_options const& opts, timing_wheel_service& wheels)
+        : downstream(std::move(down))
+        , upstream(std::move(up))
+        , options(opts)
+        , timers(wheels)
+        , index(next_connection())
+        , to_upstream(make_generator(opts, index, stream::to_upstream))
+        , to_downstream(make_generator(opts, index, stream::to_downstream))
+    {
+        if (options.reset_rate > 0) {
+            auto gen = make_generator(options, index, stream::reset);
+            if (std::bernoulli_distribution(std::min(options.reset_rate, 1.0))(gen)) {
+                reset_at = std::uniform_int_distribution<std::size_t>(0, options.reset_window)(gen);
+            }
+        }
+    }
+
+    // The generator for what is read from `from`.
+    std::mt19937& generator(tcp::socket const& from) {
+        return &from == &downstream ? to_upstream : to_downstream;
+    }
+
+    // How many more bytes may be forwarded before the connection is reset.
+    std::optional<std::size_t> bytes_until_reset() const {
+        if ( ! reset_at) {
+            return std::nullopt;
+        }
+        return *reset_at - std::min(*reset_at, forwarded);
+    }
+
+    // Counts forwarded bytes; true when it is time to reset.
+    bool account(std::size_t n) {
+        forwarded += n;
+        return reset_at && forwarded >= *reset_at;
+    }
+
+    // Aborts both sides: a zero linger time makes close() send an RST.
+    void reset() {
+        boost::system::error_code ec;
+        for (auto* s : {&downstream, &upstream}) {
+            s->set_option(net::socket_base::linger(true, 0), ec);
+            s->close(ec);
+        }
+    }
+
+    void close() {
+        boost::system::error_code ec;
+        downstream.close(ec);
+        upstream.close(ec);
+    }
+};
+
+// Lets one coroutine wait until another on the same strand has news.
+class notifier {
+public:
+    explicit notifier(net::any_io_executor ex)
+        : timer_(std::move(ex))
+    {}
+
+    net::awaitable<void> wait() {
+        timer_.expires_at(net::steady_timer::time_point::max());
+        boost::system::error_code ec;
+        co_await timer_.async_wait(net::redirect_error(use_pooled_awaitable, ec));
+    }
+
+    void notify() {
+        timer_.cancel();
+    }
+
+private:
+    net::steady_timer timer_;
+};
+
+struct segment {
+    std::string data;
+    clock::time_point due;
+};
+
+struct segment_queue {
+    std::deque<segment> segments;
+    std::size_t bytes = 0;
+    bool eof = false;
+    notifier readable;
+    notifier writable;
+
+    explicit segment_queue(net::any_io_executor ex)
+        : readable(ex)
+        , writable(ex)
+    {}
+};
+
+inline net::awaitable<void> sleep_until(wheel_timer& timer, clock::time_point due) {
+    auto const wait = std::chrono::ceil<std::chrono::milliseconds>(due - clock::now());
+    if (wait.count() > 0) {
+        co_await timer.async_wait(wait, use_pooled_awaitable);
+    }
+}
+
+inline net::awaitable<void> read_segments(connection& c, tcp::socket& from, segment_queue& q) {
+    std::vector<char> buffer(64 * 1024);
+    auto& gen = c.generator(from);
+    std::uniform_int_distribution<std::int64_t> jitter(-c.options.jitter.count(), c.options.jitter.count());
+    clock::time_point last_due{};
+
+    for(;;) {
+        while (q.bytes >= c.options.max_queued_bytes) {
+            co_await q.writable.wait();
+        }
+
+        boost::system::error_code ec;
+        auto const n = co_await from.async_read_some(net::buffer(buffer), net::redirect_error(use_pooled_awaitable, ec));
+        if (ec == net::error::eof) {
+            q.eof = true;
+            q.readable.notify();
+            co_return;
+        }
+        if (ec) {
+            throw boost::system::system_error(ec);
+        }
+
+        auto const delay = c.options.latency + std::chrono::milliseconds(c.options.jitter.count() > 0 ? jitter(gen) : 0);
+        last_due = std::max(last_due, clock::now() + std::max(delay, std::chrono::milliseconds(0)));
+        q.segments.push_back({std::string(buffer.data(), n), last_due});
+        q.bytes += n;
+        q.readable.notify();
+    }
+}
+
+inline net::awaitable<void> write_segments(connection& c, tcp::socket& to, segment_queue& q) {
+    wheel_timer timer(c.timers);
+    clock::time_point pace_at{};
+
+    for(;;) {
+        while (q.segments.empty() && ! q.eof) {
+            co_await q.readable.wait();
+        }
+        if (q.segments.empty()) {
+            boost::system::error_code ec;
+            to.shutdown(tcp::socket::shutdown_send, ec);
+            co_return;
+        }
+
+        auto const seg = std::move(q.segments.front());
+        q.segments.pop_front();
+        co_await sleep_until(timer, seg.due);
+
+        std::string_view rest = seg.data;
+        while ( ! rest.empty()) {
+            auto n = rest.size();
+            if (c.options.chunk_size != 0) {
+                n = std::min(n, c.options.chunk_size);
+            }
+            if (auto const left = c.bytes_until_reset()) {
+                n = std::min(n, *left);
+            }
+
+            // Pacing restarts from now after an idle period, so a quiet
+            // connection does not build up a burst allowance.
+            if (c.options.bandwidth_bytes_per_sec != 0) {
+                pace_at = std::max(pace_at, clock::now());
+                co_await sleep_until(timer, pace_at);
+                pace_at += std::chrono::microseconds(n * 1000000 / c.options.bandwidth_bytes_per_sec);
+            }
+
+            if (n > 0) {
+                co_await net::async_write(to, net::buffer(rest.data(), n), use_pooled_awaitable);
+                rest.remove_prefix(n);
+            }
+            // Thrown rather than returned, so that && cancels the reader,
+            // which may be parked waiting for the queue to drain.
+            if (c.account(n)) {
+                c.reset();
+                throw boost::system::system_error(net::error::connection_reset);
+            }
+        }
+
+        q.bytes -= seg.data.size();
+        q.writable.notify();
+    }
+}
+
+inline net::awaitable<void> forward_shaped(connection& c, tcp::socket& from, tcp::socket& to) {
+    using namespace net::experimental::awaitable_operators;
+    segment_queue q(co_await net::this_coro::executor);
+    co_await (read_segments(c, from, q) && write_segments(c, to, q));
+}
+
+#if defined(__linux__)
+class splice_pipe {
+public:
+    static constexpr std::size_t capacity = 1 << 20;
+
+    splice_pipe() {
+        if (::pipe2(fds_, O_NONBLOCK | O_CLOEXEC) != 0) {
+            throw boost::system::system_error(errno, boost::system::system_category(), "pipe2");
+        }
+        // Best effort: a larger pipe means fewer splice calls per read.
+        ::fcntl(fds_[1], F_SETPIPE_SZ, static_cast<int>(capacity));
+    }
+
+    splice_pipe(splice_pipe const&) = delete;
+    splice_pipe& operator=(splice_pipe const&) = delete;
+
+    ~splice_pipe() {
+        ::close(fds_[0]);
+        ::close(fds_[1]);
+    }
+
+    int read_end() const {
+        return fds_[0];
+    }
+
+    int write_end() const {
+        return fds_[1];
+    }
+
+private:
+    int fds_[2];
+};
+
+// socket -> pipe -> socket; the payload never enters user space.
+inline net::awaitable<void> forward_splice(connection& c, tcp::socket& from, tcp::socket& to) {
+    splice_pipe pipe;
+    from.native_non_blocking(true);
+    to.native_non_blocking(true);
+
+    for(;;) {
+        if (c.bytes_until_reset() == std::size_t(0)) {
+            c.reset();
+            co_return;
+        }
+        co_await from.async_wait(tcp::socket::wait_read, use_pooled_awaitable);
+
+        auto const want = std::min(splice_pipe::capacity, c.bytes_until_reset().value_or(splice_pipe::capacity));
+        auto const n = ::splice(from.native_handle(), nullptr, pipe.write_end(), nullptr, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EINTR) {
+                continue;
+            }
+            throw boost::system::system_error(errno, boost::system::system_category(), "splice");
+        }
+        if (n == 0) {
+            boost::system::error_code ec;
+            to.shutdown(tcp::socket::shutdown_send, ec);
+            co_return;
+        }
+
+        for (auto pending = static_cast<std::size_t>(n); pending > 0;) {
+            auto const m = ::splice(pipe.read_end(), nullptr, to.native_handle(), nullptr, pending, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (m < 0) {
+                if (errno == EAGAIN) {
+                    co_await to.async_wait(tcp::socket::wait_write, use_pooled_awaitable);
+                    continue;
+                }
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw boost::system::system_error(errno, boost::system::system_category(), "splice");
+            }
+            pending -= static_cast<std::size_t>(m);
+        }
+
+        if (c.account(static_cast<std::size_t>(n))) {
+            c.reset();
+            co_return;
+        }
+    }
+}
+#endif
+
+inline net::awaitable<void> forward(connection& c, tcp::socket& from, tcp::socket& to) {
+    try {
+#if defined(__linux__)
+        if ( ! c.options.shaped()) {
+            co_await forward_splice(c, from, to);
+            co_return;
+        }
+#endif
+        co_await forward_shaped(c, from, to);
+    } catch (boost::system::system_error&) {
+        // A failed or reset side ends the whole connection.
+        c.close();
+    }
+}
+
+} // namespace proxy
+
+// Runs one proxied connection. Expected to be spawned on a strand: the two
+// directions and their readers and writers share connection state.
+inline net::awaitable<void> do_proxy(tcp::socket downstream, proxy_options const& options, timing_wheel_service& timers) {
+    using namespace net::experimental::awaitable_operators;
+
+    tcp::socket upstream(co_await net::this_coro::executor);
+    co_await net::async_connect(upstream, options.upstream_endpoints, use_pooled_awaitable);
+
+    // Small writes are the point when re-chunking, and Nagle would only add
+    // delay that was not asked for.
+    downstream.set_option(tcp::no_delay(true));
+    upstream.set_option(tcp::no_delay(true));
+
+    proxy::connection c(std::move(downstream), std::move(upstream), options, timers);
+    co_await (proxy::forward(c, c.downstream, c.upstream) && proxy::forward(c, c.upstream, c.downstream));
+    c.close();
+}
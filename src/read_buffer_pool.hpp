@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include <boost/beast/core/flat_buffer.hpp>
+
+// Read buffers that sessions borrow only while a request is arriving.
+//
+// A keep-alive connection spends most of its life idle. Instead of owning a
+// flat_buffer that stays at the size of the largest request it has seen, a
+// session waits for the socket to become readable, borrows a buffer from its
+// thread's pool for the request, and gives it back once the request is
+// consumed with nothing pipelined behind it. An idle connection then costs
+// its socket and a small coroutine frame.
+//
+// Each thread keeps up to max_pooled buffers. One that grew past
+// max_capacity, say for a large urlencoded body, is freed instead of kept.
+
+class read_buffer_pool {
+public:
+    static constexpr std::size_t max_pooled = 256;
+    static constexpr std::size_t max_capacity = 64 * 1024;
+
+    static boost::beast::flat_buffer take() {
+        auto& pool = local();
+        if (pool.empty()) {
+            return {};
+        }
+        auto buffer = std::move(pool.back());
+        pool.pop_back();
+        return buffer;
+    }
+
+    static void give(boost::beast::flat_buffer&& buffer) {
+        auto& pool = local();
+        if (buffer.capacity() > max_capacity || pool.size() >= max_pooled) {
+            return;
+        }
+        buffer.clear();
+        pool.push_back(std::move(buffer));
+    }
+
+private:
+    static std::vector<boost::beast::flat_buffer>& local() {
+        thread_local std::vector<boost::beast::flat_buffer> pool;
+        return pool;
+    }
+};
+
+// A session's handle on a borrowed buffer.
+class pooled_read_buffer {
+public:
+    pooled_read_buffer() = default;
+
+    pooled_read_buffer(pooled_read_buffer const&) = delete;
+    pooled_read_buffer& operator=(pooled_read_buffer const&) = delete;
+
+    ~pooled_read_buffer() {
+        release();
+    }
+
+    // Whether bytes of a next request are already buffered.
+    bool holds_data() const {
+        return buffer_ && buffer_->size() > 0;
+    }
+
+    boost::beast::flat_buffer& acquire() {
+        if ( ! buffer_) {
+            buffer_.emplace(read_buffer_pool::take());
+        }
+        return *buffer_;
+    }
+
+    void release() {
+        if (buffer_) {
+            read_buffer_pool::give(std::move(*buffer_));
+            buffer_.reset();
+        }
+    }
+
+private:
+    std::optional<boost::beast::flat_buffer> buffer_;
+};
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+#include <boost/asio/bind_allocator.hpp>
+#include <boost/asio/use_awaitable.hpp>
+
+// Per-thread free lists for the short-lived blocks a connection allocates on
+// every operation: asio/beast operation state and type-erased handlers.
+//
+// Blocks are rounded up to a power-of-two size class between 32 bytes and
+// 8 KiB; anything larger goes straight to operator new. Each thread keeps a
+// bounded number of blocks per class, so a burst of connections is served
+// from the pool afterwards but idle threads do not hoard memory. A block may
+// be released on a different thread than the one that allocated it; it then
+// simply joins that thread's list.
+
+class recycling_pool {
+public:
+    static constexpr std::size_t min_class_bits = 5;
+    static constexpr std::size_t max_class_bits = 13;
+    static constexpr std::size_t cached_bytes_per_class = 256 * 1024;
+
+    static void* allocate(std::size_t size) {
+        auto const cls = size_class(size);
+        if (cls >= classes) {
+            return ::operator new(size);
+        }
+        auto& c = local();
+        if (auto* block = c.heads[cls]) {
+            c.heads[cls] = block->next;
+            --c.counts[cls];
+            return block;
+        }
+        return ::operator new(class_size(cls));
+    }
+
+    static void deallocate(void* p, std::size_t size) noexcept {
+        auto const cls = size_class(size);
+        if (cls >= classes) {
+            ::operator delete(p);
+            return;
+        }
+        auto& c = local();
+        if (c.counts[cls] >= max_cached(cls)) {
+            ::operator delete(p);
+            return;
+        }
+        auto* block = static_cast<free_block*>(p);
+        block->next = c.heads[cls];
+        c.heads[cls] = block;
+        ++c.counts[cls];
+    }
+
+private:
+    static constexpr std::size_t classes = max_class_bits - min_class_bits + 1;
+
+    struct free_block {
+        free_block* next;
+    };
+
+    struct cache {
+        free_block* heads[classes] = {};
+        std::size_t counts[classes] = {};
+
+        ~cache() {
+            for (auto* head : heads) {
+                while (head) {
+                    auto* next = head->next;
+                    ::operator delete(head);
+                    head = next;
+                }
+            }
+        }
+    };
+
+    static cache& local() {
+        thread_local cache c;
+        return c;
+    }
+
+    static std::size_t size_class(std::size_t size) {
+        auto const bits = static_cast<std::size_t>(std::bit_width(std::max<std::size_t>(size, 1) - 1));
+        return bits <= min_class_bits ? 0 : bits - min_class_bits;
+    }
+
+    static std::size_t class_size(std::size_t cls) {
+        return std::size_t(1) << (cls + min_class_bits);
+    }
+
+    static std::size_t max_cached(std::size_t cls) {
+        return std::max<std::size_t>(16, cached_bytes_per_class / class_size(cls));
+    }
+};
+
+template <typename T>
+class recycling_allocator {
+public:
+    using value_type = T;
+
+    recycling_allocator() noexcept = default;
+
+    template <typename U>
+    recycling_allocator(recycling_allocator<U> const&) noexcept {}
+
+    T* allocate(std::size_t n) {
+        return static_cast<T*>(recycling_pool::allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, std::size_t n) noexcept {
+        recycling_pool::deallocate(p, n * sizeof(T));
+    }
+
+    template <typename U>
+    bool operator==(recycling_allocator<U> const&) const noexcept {
+        return true;
+    }
+};
+
+// Completion token for session I/O: use_awaitable with operation state drawn
+// from the pool. SERVER_NO_RECYCLING_POOL falls back to asio's defaults, for
+// before/after comparisons.
+#if defined(SERVER_NO_RECYCLING_POOL)
+inline auto const use_pooled_awaitable = boost::asio::use_awaitable;
+#else
+inline auto const use_pooled_awaitable = boost::asio::bind_allocator(recycling_allocator<void>(), boost::asio::use_awaitable);
+#endif
@@ -0,0 +1,680 @@
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <boost/beast/version.hpp>
+
+#include <unistd.h>
+
+#include <boost/json.hpp>
+
+#include <boost/url.hpp>
+
+#include "alloc_counter.hpp"
+#include "form_parser.hpp"
+#include "request_handler.hpp"
+#include "validators.hpp"
+#include "virtual_clock.hpp"
+
+std::string session_cookie(beast::string_view cookie_header) {
+    while ( ! cookie_header.empty()) {
+        auto const semi = cookie_header.find(';');
+        auto pair = cookie_header.substr(0, semi);
+        cookie_header = semi == beast::string_view::npos ? beast::string_view{} : cookie_header.substr(semi + 1);
+
+        while ( ! pair.empty() && pair.front() == ' ') {
+            pair.remove_prefix(1);
+        }
+        auto const eq = pair.find('=');
+        if (eq != beast::string_view::npos && pair.substr(0, eq) == session_cookie_name) {
+            return std::string(pair.substr(eq + 1));
+        }
+    }
+    return {};
+}
+
+// Query parameters arrive percent-decoded, so a cookie name or value could
+// hold CR/LF and end the Set-Cookie field early. Control characters and the
+// separators of a Set-Cookie value are refused instead; a name cannot be
+// empty or hold '='.
+static bool safe_cookie_text(std::string_view text, bool name) {
+    if (name && text.empty()) {
+        return false;
+    }
+    return std::none_of(text.begin(), text.end(), [name](char ch) {
+        auto const c = static_cast<unsigned char>(ch);
+        return c < 0x20 || c == 0x7f || c == ';' || c == ',' || (name && c == '=');
+    });
+}
+
+std::optional<std::chrono::seconds> seconds_until_http_date(std::string const& date) {
+    auto const expires = parse_http_date(date);
+    if ( ! expires) {
+        return std::nullopt;
+    }
+    return std::chrono::duration_cast<std::chrono::seconds>(*expires - std::chrono::system_clock::now());
+}
+
+std::optional<bigfile_params> parse_bigfile_params(beast::string_view target) {
+    if ( ! target.starts_with("/bigfile")) {
+        return std::nullopt;
+    }
+
+    // total_size=1000000&chunk_size=4096, optionally &delay_ms=50&seed=42
+    // &digest=sha-256
+    bigfile_params result;
+    bool have_total = false;
+
+    for (auto const& param : form::fields::of_query({target.data(), target.size()})) {
+        auto const parse = [&param](auto& out) {
+            auto const value = param.raw_value;
+            auto const [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), out);
+            return ec == std::errc() && ptr == value.data() + value.size();
+        };
+
+        bool ok = false;
+        if (param.raw_key == "total_size") {
+            ok = parse(result.total_size);
+            have_total = true;
+        } else if (param.raw_key == "chunk_size") {
+            ok = parse(result.chunk_size);
+        } else if (param.raw_key == "delay_ms") {
+            ok = parse(result.delay_ms);
+        } else if (param.raw_key == "seed") {
+            ok = parse(result.seed.emplace());
+        } else if (param.raw_key == "digest") {
+            result.digest = parse_digest_algorithm(param.raw_value);
+            ok = result.digest.has_value();
+        }
+        if ( ! ok) {
+            return std::nullopt;
+        }
+    }
+
+    if ( ! have_total || result.chunk_size == 0) {
+        return std::nullopt;
+    }
+    return result;
+}
+
+std::optional<std::string> bigfile_etag(bigfile_params const& params) {
+    if ( ! params.seed) {
+        return std::nullopt;
+    }
+    // The bytes depend on the seed, the total size, how they are split into
+    // chunks, and the payload pool they are sliced from.
+    char buf[96];
+    auto const n = std::snprintf(buf, sizeof(buf), "\"bf-%llx-%zx-%zx-%llx\"",
+        static_cast<unsigned long long>(*params.seed), params.total_size, params.chunk_size,
+        static_cast<unsigned long long>(payload_pool::seed));
+    return std::string(buf, static_cast<std::size_t>(n));
+}
+
+std::optional<upload_params> parse_upload_params(http::request_header<> const& req) {
+    auto const target = to_string_view(req.target());
+    auto const path = target.substr(0, target.find('?'));
+    if ( ! (req.method() == http::verb::post && path == "/post") && ! (req.method() == http::verb::put && path == "/put")) {
+        return std::nullopt;
+    }
+    auto boundary = multipart::boundary_of(to_string_view(req[http::field::content_type]));
+    if ( ! boundary) {
+        return std::nullopt;
+    }
+
+    // ?sink=discard|hash|file, hash by default.
+    upload_params result{std::move(*boundary)};
+    if (auto const sink = form::fields::of_query(target).find("sink")) {
+        if (sink->value_is("discard")) {
+            result.sink = multipart::part_sink::mode::discard;
+        } else if (sink->value_is("file")) {
+            result.sink = multipart::part_sink::mode::file;
+        } else if ( ! sink->value_is("hash")) {
+            result.sink.reset();
+        }
+    }
+    return result;
+}
+
+// The process's resident set size, where /proc/self/statm exists.
+static std::optional<std::uint64_t> resident_bytes() {
+    std::ifstream statm("/proc/self/statm");
+    std::uint64_t size = 0;
+    std::uint64_t resident = 0;
+    if ( ! (statm >> size >> resident)) {
+        return std::nullopt;
+    }
+    return resident * static_cast<std::uint64_t>(::sysconf(_SC_PAGESIZE));
+}
+
+// The fields the /put and /post form handlers expect.
+constexpr std::pair<std::string_view, std::string_view> expected_form[] = {
+    {"foo", "42"},
+    {"bar", "21"},
+    {"foo bar", "23"},
+};
+
+template <typename Body, typename Allocator>
+http::message_generator handle_request(http::request<Body, http::basic_fields<Allocator>>&& req, server_state& state) {
+    auto const bad_request = [&req](beast::string_view why) {
+        http::response<http::string_body> res{http::status::bad_request, req.version()};
+        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+        res.set(http::field::content_type, "text/html");
+        res.keep_alive(req.keep_alive());
+        res.body() = std::string(why);
+        res.prepare_payload();
+        return res;
+    };
+
+    auto const not_found = [&req](beast::string_view target) {
+        http::response<http::string_body> res{http::status::not_found, req.version()};
+        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+        res.set(http::field::content_type, "text/html");
+        res.keep_alive(req.keep_alive());
+        res.body() = "The resource '" + std::string(target) + "' was not found.";
+        res.prepare_payload();
+        return res;
+    };
+
+    auto const server_error = [&req](beast::string_view what) {
+        http::response<http::string_body> res{http::status::internal_server_error, req.version()};
+        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+        res.set(http::field::content_type, "text/html");
+        res.keep_alive(req.keep_alive());
+        res.body() = "An error occurred: '" + std::string(what) + "'";
+        res.prepare_payload();
+        return res;
+    };
+
+    if (state.options.log_requests) {
+        std::cout << "Request: " << req.target() << '\n';
+    }
+
+    // if (req.method() != http::verb::get && req.method() != http::verb::post) {
+    //     return bad_request("Unknown HTTP-method");
+    // }
+
+    // Handling /echo
+    if (req.target() == "/echo" && req.method() == http::verb::post) {
+        http::response<http::string_body> res{http::status::ok, req.version()};
+        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+        res.set(http::field::content_type, "text/plain");
+        res.keep_alive(req.keep_alive());
+        res.body() = req.body();
+        res.prepare_payload();
+        return res;
+    }
+
+    // Handling /timestamp
+    if (req.target() == "/timestamp" && req.method() == http::verb::get) {
+        auto now = std::chrono::system_clock::now();
+        std::time_t now_time = std::chrono::system_clock::to_time_t(now);
+        http::response<http::string_body> res{http::status::ok, req.version()};
+        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+        res.set(http::field::content_type, "text/plain");
+        res.keep_alive(req.keep_alive());
+        res.body() = std::ctime(&now_time);
+        res.prepare_payload();
+        return res;
+    }
+
+    // Handling /status
+    if (req.target() == "/status" && req.method() == http::verb::get) {
+        http::response<http::string_body> res{http::status::ok, req.version()};
+        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+        res.set(http::field::content_type, "text/plain");
+        res.keep_alive(req.keep_alive());
+        res.body() = "Server is running smoothly!";
+        res.prepare_payload();
+        return res;
+    }
+
+    // Handling /bigfile
+    if (req.target().starts_with("/bigfile")) {
+        // Well-formed requests are streamed by do_session, see write_bigfile.
+        return bad_request("Invalid query string");
+    }
+
+    // connection.cpp
+    // Handling /headers
+    if (req.target() == "/headers" && req.method() == http::verb::get) {
+        http::response<http::string_body> res{http::status::ok, req.version()};
+        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+        res.set(http::field::content_type, "application/json");
+        res.keep_alive(req.keep_alive());
+
+        boost::json::object headers_obj;
+        for (const auto& header : req) {
+            headers_obj[header.name_string()] = header.value();
+        }
+        boost::json::object response_obj;
+        response_obj["headers"] = headers_obj;
+
+        res.body() = boost::json::serialize(response_obj);
+        res.prepare_payload();
+        return res;
+    }
+
+    // get-redirect
+    if (req.target().starts_with("/redirect-to?url=")) {
+        http::response<http::string_body> res{http::status::found, req.version()};
+        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+
+        std::string target_url = req.target().substr(18);
+        if (target_url == "%2Fget") {
+            target_url = "/get";  // ????
+        }
+
+        res.set(http::field::location, target_url);
+
+        if (target_url == "/get") {
+            res.set(http::field::content_type, "application/json");
+            boost::json::object headers_obj;
+
+            for (const auto& header : req) {
+                headers_obj[header.name_string()] = header.value();
+            }
+            boost::json::object response_obj;
+            response_obj["headers"] = headers_obj;
+            res.body() = boost::json::serialize(response_obj);
+        }
+
+        res.prepare_payload();
+        return res;
+    }
+
+    // too-many-redirects
+    if (req.target().starts_with("/redirect/")) {
+        http::response<http::string_body> res{http::status::found, req.version()};
+        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+
+        std::string redirect_count_str = req.target().substr(10);
+        int redirect_count = std::atoi(redirect_count_str.c_str());
+
+        if (redirect_count > 0) {
+            --redirect_count;
+
+            std::string next_redirect = "/redirect/" + std::to_string(redirect_count);
+            res.set(http::field::location, next_redirect);
+        } else {
+            res.result(http::status::ok);
+            res.set(http::field::content_type, "application/json");
+            boost::json::object response_obj;
+            response_obj["message"] = "Final destination reached!";
+            res.body() = boost::json::serialize(response_obj);
+        }
+
+        res.prepare_payload();
+        return res;
+    }
+
+    // download
+    if (req.target() == "/image") {
+        std::filesystem::path image_path = "requests-test.png";   //TODO
+
+        auto const image = state.files.get(image_path);
+        if ( ! image) {
+            http::response<http::string_body> res{http::status::not_found, req.version()};
+            res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+            res.set(http::field::content_type, "text/plain");
+            res.body() = "File not found";
+            res.prepare_payload();
+
+            return res;
+        }
+
+        if (not_modified(req.method(), req.base(), image->etag, image->modified)) {
+            return not_modified_response(req.version(), req.keep_alive(), image->etag, image->last_modified, state.options.cache_control);
+        }
+
+        http::response<shared_buffer_body> res{http::status::ok, req.version()};
+        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+        res.set(http::field::content_type, "image/png");
+        res.set(http::field::etag, image->etag);
+        res.set(http::field::last_modified, image->last_modified);
+        if ( ! state.options.cache_control.empty()) {
+            res.set(http::field::cache_control, state.options.cache_control);
+        }
+        res.keep_alive(req.keep_alive());
+        res.body() = image->data;
+        res.prepare_payload();
+
+        return res;
+    }
+
+    // download-redirect
+    if (req.target() == "/redirect-to?url=%2Fimage") {
+        http::response<http::string_body> res{http::status::found, req.version()};
+        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+        res.set(http::field::location, "/image");
+        return res;
+    }
+
+    // delete
+    if (req.method() == http::verb::delete_ && req.target() == "/delete") {
+        boost::json::value val = boost::json::parse(req.body());
+        boost::json::object& obj = val.as_object();
+
+        std::string test_key;
+        if (obj.contains("test-key")) {
+            test_key = obj["test-key"].as_string().c_str();
+        }
+
+        if (test_key == "test-value") {
+            http::response<http::string_body> res{http::status::ok, req.version()};
+            res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+            res.set(http::field::content_type, "application/json");
+            res.body() = R"({"status": "success"})";
+            res.prepare_payload();
+            return res;
+        } else {
+            http::response<http::string_body> res{http::status::bad_request, req.version()};
+            res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+            res.set(http::field::content_type, "application/json");
+            res.body() = R"({"status": "failure"})";
+            res.prepare_payload();
+            return res;
+        }
+    }
+
+    // patch-form, ahead of patch-json, which takes any other PATCH /patch
+    if (req.method() == http::verb::patch && req.target() == "/patch" &&
+        req[http::field::content_type] == "application/x-www-form-urlencoded") {
+        boost::json::object obj;
+        std::string key;
+        std::string value;
+        for (auto const& field : form::fields(req.body())) {
+            obj[form::decode(field.raw_key, key)] = form::decode(field.raw_value, value);
+        }
+
+        http::response<http::string_body> res{http::status::ok, req.version()};
+        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+        res.set(http::field::content_type, "application/x-www-form-urlencoded");
+        std::string serialized_json = boost::json::serialize(boost::json::value_from(obj));
+        res.body() = R"({"status": "success", "form": )" + serialized_json + "}";
+        res.prepare_payload();
+
+        return res;
+    }
+
+    // patch-json
+    if (req.method() == http::verb::patch && req.target() == "/patch") {
+        std::string body_str(req.body().begin(), req.body().end());
+        boost::json::value jv = boost::json::parse(body_str);
+        boost::json::object obj = jv.as_object();
+
+        if (obj["test-key"].as_string() == "test-value") {
+            http::response<http::string_body> res{http::status::ok, req.version()};
+            res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+            res.set(http::field::content_type, "application/json");
+            res.body() = R"({"status": "success"})";
+            res.prepare_payload();
+
+            return res;
+        } else {
+            http::response<http::string_body> res{http::status::bad_request, req.version()};
+            res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+            res.set(http::field::content_type, "application/json");
+            res.body() = R"({"status": "failure"})";
+            res.prepare_payload();
+
+            return res;
+        }
+    }
+
+    // put-form
+    if (req.method() == http::verb::put && req.target() == "/put" &&
+        req[http::field::content_type] == "application/x-www-form-urlencoded") {
+
+        if (form::fields(req.body()).contains_all(expected_form)) {
+            http::response<http::string_body> res{http::status::ok, req.version()};
+            res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+            res.set(http::field::content_type, "application/x-www-form-urlencoded");
+            res.body() = "foo=42&bar=21&foo%20bar=23";
+            res.prepare_payload();
+            return res;
+        } else {
+            http::response<http::string_body> res{http::status::bad_request, req.version()};
+            res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+            res.set(http::field::content_type, "text/plain");
+            res.body() = "Invalid form data";
+            res.prepare_payload();
+            return res;
+        }
+    }
+
+    // put-json
+    if (req.method() == http::verb::put && req.target() == "/put" &&
+        req[http::field::content_type] == "application/json") {
+
+        boost::json::value json_value = boost::json::parse(req.body());
+
+        if (json_value.is_object() &&
+            json_value.as_object().contains("test-key") &&
+            json_value.as_object()["test-key"] == "test-value") {
+
+            http::response<http::string_body> res{http::status::ok, req.version()};
+            res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+            res.set(http::field::content_type, "application/json");
+            res.body() = R"({"status": "success"})";
+            res.prepare_payload();
+
+            return res;
+        }
+    }
+
+    // post-form
+    if (req.method() == http::verb::post && req.target() == "/post" &&
+        req[http::field::content_type] == "application/x-www-form-urlencoded") {
+
+        if (form::fields(req.body()).contains_all(expected_form)) {
+            http::response<http::string_body> res{http::status::ok, req.version()};
+            res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+            res.set(http::field::content_type, "application/x-www-form-urlencoded");
+            res.body() = "foo=42&bar=21&foo%20bar=23";
+            res.prepare_payload();
+            return res;
+        } else {
+            http::response<http::string_body> res{http::status::bad_request, req.version()};
+            res.body() = "Invalid form data";
+            res.prepare_payload();
+            return res;
+        }
+    }
+
+    // post-json
+    if (req.method() == http::verb::post && req.target() == "/post" &&
+        req[http::field::content_type] == "application/json") {
+
+        auto json_data = boost::json::parse(req.body());
+
+        if (json_data.at("test-key").as_string() == "test-value") {
+            http::response<http::string_body> res{http::status::ok, req.version()};
+            res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+            res.set(http::field::content_type, "application/json");
+            res.body() = R"({"message":"Data received"})";
+            res.prepare_payload();
+            return res;
+        } else {
+            http::response<http::string_body> res{http::status::bad_request, req.version()};
+            res.body() = R"({"error":"Invalid JSON data"})";
+            res.prepare_payload();
+            return res;
+        }
+    }
+
+    // get
+    if (req.method() == http::verb::get && req.target() == "/get") {
+        http::response<http::string_body> res{http::status::ok, req.version()};
+        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+        res.set(http::field::content_type, "application/json");
+
+        boost::json::object headers_json;
+        for (const auto& header : req.base()) {
+            headers_json[header.name_string()] = header.value();
+        }
+
+        boost::json::object response_body;
+        response_body["headers"] = headers_json;
+
+        res.body() = boost::json::serialize(response_body);
+        res.prepare_payload();
+        return res;
+    }
+
+    // Server counters, for benchmarks
+    if (req.target() == "/__stats" && req.method() == http::verb::get) {
+        http::response<http::string_body> res{http::status::ok, req.version()};
+        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+        res.set(http::field::content_type, "application/json");
+        res.keep_alive(req.keep_alive());
+
+        boost::json::object stats_obj;
+        stats_obj["connections"] = state.connections.load(std::memory_order_relaxed);
+        if (auto const n = allocations()) {
+            stats_obj["allocations"] = *n;
+        } else {
+            stats_obj["allocations"] = nullptr;
+        }
+        stats_obj["in_flight"] = state.admission.in_flight();
+        stats_obj["admission_limit"] = state.admission.limit();
+        stats_obj["shed"] = state.admission.shed();
+        stats_obj["loop_lag_us"] = state.admission.last_lag().count();
+        if (auto const rss = resident_bytes()) {
+            stats_obj["rss_bytes"] = *rss;
+        } else {
+            stats_obj["rss_bytes"] = nullptr;
+        }
+        if (state.workers) {
+            // Prefork mode: totals over every worker process.
+            auto const t = shared_stats::sum(*state.workers);
+            stats_obj["workers"] = {
+                {"live", t.live_workers},
+                {"connections", t.connections},
+                {"requests", t.requests},
+                {"started", t.started},
+                {"crashes", state.workers->crashes.load(std::memory_order_relaxed)},
+            };
+        }
+        res.body() = boost::json::serialize(stats_obj);
+        res.prepare_payload();
+        return res;
+    }
+
+    // Sampled request traces, as Chrome trace-event JSON
+    if (req.target() == "/__trace" && req.method() == http::verb::get) {
+        http::response<http::string_body> res{http::status::ok, req.version()};
+        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+        res.set(http::field::content_type, "application/json");
+        res.keep_alive(req.keep_alive());
+        res.body() = state.tracing.export_chrome_json();
+        res.prepare_payload();
+        return res;
+    }
+
+    // cookie.cpp
+    if (req.target() == "/cookies" || req.target().starts_with("/cookies/set?") || req.target().starts_with("/cookies/delete?")) {
+        auto url = boost::urls::parse_origin_form(req.target());
+        if ( ! url) {
+            return bad_request("Invalid query string");
+        }
+
+        // The jar is keyed by a session cookie; hand one out on first contact.
+        std::string session_id = session_cookie(req[http::field::cookie]);
+        bool const new_session = session_id.empty();
+        if (new_session) {
+            session_id = cookie_jar::new_session_id();
+        }
+
+        http::response<http::string_body> res{http::status::ok, req.version()};
+        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+        res.set(http::field::content_type, "application/json");
+        res.keep_alive(req.keep_alive());
+        if (new_session) {
+            res.insert(http::field::set_cookie, std::string(session_cookie_name) + "=" + session_id + "; Path=/");
+        }
+
+        if (url->path() == "/cookies/set") {
+            // Reserved parameters apply to every cookie set by this request.
+            std::optional<std::chrono::seconds> max_age;
+            std::string attributes = "; Path=/";
+            for (auto const& param : url->params()) {
+                if (param.key == "max_age") {
+                    std::int64_t seconds = 0;
+                    auto const [ptr, ec] = std::from_chars(param.value.data(), param.value.data() + param.value.size(), seconds);
+                    if (ec != std::errc() || ptr != param.value.data() + param.value.size()) {
+                        return bad_request("Invalid max_age");
+                    }
+                    max_age = std::chrono::seconds(seconds);
+                    attributes += "; Max-Age=" + std::to_string(max_age->count());
+                } else if (param.key == "expires") {
+                    auto const remaining = seconds_until_http_date(param.value);
+                    if ( ! remaining || ! safe_cookie_text(param.value, false)) {
+                        return bad_request("Invalid expires date");
+                    }
+                    // The client keeps the absolute date, which passes in real
+                    // time; the jar counts virtual seconds.
+                    max_age = std::chrono::duration_cast<std::chrono::seconds>(virtual_clock::from_real(*remaining));
+                    attributes += "; Expires=" + param.value;
+                }
+            }
+
+            for (auto const& param : url->params()) {
+                if (param.key == "max_age" || param.key == "expires" || param.key == session_cookie_name) {
+                    continue;
+                }
+                if ( ! safe_cookie_text(param.key, true) || ! safe_cookie_text(param.value, false)) {
+                    return bad_request("Invalid cookie name or value");
+                }
+            }
+            for (auto const& param : url->params()) {
+                if (param.key == "max_age" || param.key == "expires" || param.key == session_cookie_name) {
+                    continue;
+                }
+                // A cookie the jar has no room for is not handed to the
+                // client either.
+                if (state.cookies.set(session_id, param.key, param.value, max_age)) {
+                    res.insert(http::field::set_cookie, param.key + "=" + param.value + attributes);
+                }
+            }
+        } else if (url->path() == "/cookies/delete") {
+            boost::json::array deleted;
+            for (auto const& param : url->params()) {
+                if ( ! safe_cookie_text(param.key, true)) {
+                    return bad_request("Invalid cookie name");
+                }
+            }
+            for (auto const& param : url->params()) {
+                state.cookies.erase(session_id, param.key);
+                res.insert(http::field::set_cookie, param.key + "=; Max-Age=0; Path=/");
+                deleted.emplace_back(param.key);
+            }
+            boost::json::object response_obj;
+            response_obj["deleted"] = deleted.size() == 1 ? boost::json::value(deleted.front()) : boost::json::value(deleted);
+            res.body() = boost::json::serialize(response_obj);
+            res.prepare_payload();
+            return res;
+        }
+
+        boost::json::object cookies_obj;
+        for (auto const& [name, value] : state.cookies.get(session_id)) {
+            cookies_obj[name] = value;
+        }
+        boost::json::object response_obj;
+        response_obj["cookies"] = cookies_obj;
+        res.body() = boost::json::serialize(response_obj);
+        res.prepare_payload();
+        return res;
+    }
+    return not_found(req.target());
+}
+
+template http::message_generator handle_request(http::request<http::string_body>&& req, server_state& state);
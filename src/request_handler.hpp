@@ -0,0 +1,57 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+
+#include "digest.hpp"
+#include "multipart.hpp"
+#include "server_state.hpp"
+
+// The request-handling core: everything between a parsed request and the
+// response to write, with no I/O. do_session drives it over a socket; the
+// benchmarks in bench/ drive it from memory.
+
+namespace beast = boost::beast;
+namespace http = beast::http;
+
+constexpr std::string_view session_cookie_name = "sid";
+
+std::string session_cookie(beast::string_view cookie_header);
+
+// Parses an IMF-fixdate ("Sun, 06 Nov 1994 08:49:37 GMT") into a Max-Age.
+std::optional<std::chrono::seconds> seconds_until_http_date(std::string const& date);
+
+struct bigfile_params {
+    size_t total_size = 0;
+    size_t chunk_size = 0;
+    size_t delay_ms = 0;
+    std::optional<uint64_t> seed;       // same seed, same bytes
+    std::optional<digest_algorithm> digest;
+};
+
+std::optional<bigfile_params> parse_bigfile_params(beast::string_view target);
+
+// A strong ETag for a seeded /bigfile; unseeded downloads have no identity.
+std::optional<std::string> bigfile_etag(bigfile_params const& params);
+
+struct upload_params {
+    std::string boundary;
+    std::optional<multipart::part_sink::mode> sink = multipart::part_sink::mode::hash;   // empty for an unknown ?sink=
+};
+
+// A multipart/form-data POST /post or PUT /put, told apart by its header
+// alone so that the body can be streamed instead of buffered. An unknown
+// ?sink= still makes it an upload, one to be refused.
+std::optional<upload_params> parse_upload_params(http::request_header<> const& req);
+
+template <typename Body, typename Allocator>
+http::message_generator handle_request(http::request<Body, http::basic_fields<Allocator>>&& req, server_state& state);
+
+extern template http::message_generator handle_request(http::request<http::string_body>&& req, server_state& state);
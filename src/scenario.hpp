@@ -0,0 +1,367 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <boost/beast/http.hpp>
+#include <boost/beast/version.hpp>
+
+#include <boost/json.hpp>
+
+#include "form_parser.hpp"
+
+// A scenario file declares mocked routes as data instead of C++:
+//
+//  {
+//    "routes": [
+//      {
+//        "method": "POST",
+//        "path": "/post",                     // or "path_prefix": "/post"
+//        "match": {
+//          "query":   { "name": "value" },
+//          "headers": { "content-type": "application/json" },
+//          "json":    { "test-key": "test-value" },
+//          "form":    { "foo": "42" }
+//        },
+//        "status": 200,
+//        "headers": { "Content-Type": "application/json" },
+//        "body": "{\"message\":\"Data received\"}",   // or "body_json": { ... }
+//        "delay_ms": 0,
+//        "rate_bytes_per_sec": 0,
+//        "chunk_size": 0
+//      }
+//    ]
+//  }
+//
+// The file is compiled once into an immutable scenario_table whose responses
+// are already serialized to wire bytes. Routes are tried in file order and the
+// first match wins; requests that match nothing fall through to handle_request.
+// A route without a "method" also answers HEAD, with the header only.
+
+namespace scenario {
+
+namespace http = boost::beast::http;
+namespace json = boost::json;
+
+using string_pairs = std::vector<std::pair<std::string, std::string>>;
+
+struct matcher {
+    std::optional<http::verb> method;
+    std::string path;
+    bool prefix = false;
+    string_pairs query;
+    string_pairs headers;
+    string_pairs json_fields;
+    string_pairs form_fields;
+};
+
+struct route {
+    matcher match;
+    std::string keep_alive_bytes;   // serialized response, connection stays open
+    std::string close_bytes;        // serialized response with "Connection: close"
+    std::size_t keep_alive_header_size = 0;
+    std::size_t close_header_size = 0;
+    std::chrono::milliseconds delay{0};
+    std::size_t rate_bytes_per_sec = 0;
+    std::size_t chunk_size = 0;
+
+    // The wire bytes to send; a HEAD request gets the header alone.
+    std::string_view response(bool keep_alive, bool head) const {
+        std::string_view bytes = keep_alive ? keep_alive_bytes : close_bytes;
+        return head ? bytes.substr(0, keep_alive ? keep_alive_header_size : close_header_size) : bytes;
+    }
+
+    bool shaped() const {
+        return delay.count() > 0 || rate_bytes_per_sec != 0 || chunk_size != 0;
+    }
+
+    // Bytes per write of a shaped response: chunk_size, or a tenth of a
+    // second's worth at the rate.
+    std::size_t write_size() const {
+        return chunk_size != 0 ? chunk_size : std::max<std::size_t>(1, rate_bytes_per_sec / 10);
+    }
+
+    // How long the delay and pacing of a size-byte response take: every
+    // write but the last is paced.
+    std::chrono::milliseconds scheduled_time(std::size_t size) const {
+        auto t = delay;
+        if (rate_bytes_per_sec != 0 && size > 0) {
+            auto const paced = size - ((size - 1) % write_size() + 1);
+            t += std::chrono::milliseconds(paced * 1000 / rate_bytes_per_sec);
+        }
+        return t;
+    }
+};
+
+// Lets exact_routes_ be searched with a string_view, without building a
+// std::string key per request.
+struct string_hash {
+    using is_transparent = void;
+
+    std::size_t operator()(std::string_view s) const noexcept {
+        return std::hash<std::string_view>{}(s);
+    }
+};
+
+inline std::string_view request_path(std::string_view target) {
+    auto const pos = target.find('?');
+    return pos == std::string_view::npos ? target : target.substr(0, pos);
+}
+
+class table {
+public:
+    table() = default;
+
+    explicit table(std::vector<route> routes)
+        : routes_(std::move(routes))
+    {
+        for (std::size_t i = 0; i < routes_.size(); ++i) {
+            if (routes_[i].match.prefix) {
+                prefix_routes_.push_back(i);
+            } else {
+                exact_routes_[routes_[i].match.path].push_back(i);
+            }
+        }
+    }
+
+    std::size_t size() const {
+        return routes_.size();
+    }
+
+    template <typename Allocator>
+    route const* find(http::request<http::string_body, http::basic_fields<Allocator>> const& req) const {
+        if (routes_.empty()) {
+            return nullptr;
+        }
+
+        auto const path = request_path(req.target());
+        std::size_t best = routes_.size();
+
+        if (auto it = exact_routes_.find(path); it != exact_routes_.end()) {
+            for (auto i : it->second) {
+                if (matches(routes_[i].match, req)) {
+                    best = i;
+                    break;
+                }
+            }
+        }
+        for (auto i : prefix_routes_) {
+            if (i >= best) {
+                break;
+            }
+            if (path.starts_with(routes_[i].match.path) && matches(routes_[i].match, req)) {
+                best = i;
+                break;
+            }
+        }
+        return best == routes_.size() ? nullptr : &routes_[best];
+    }
+
+private:
+    template <typename Allocator>
+    static bool matches(matcher const& m, http::request<http::string_body, http::basic_fields<Allocator>> const& req) {
+        if (m.method && *m.method != req.method()) {
+            return false;
+        }
+
+        for (auto const& [name, value] : m.headers) {
+            if (req[name] != value) {
+                return false;
+            }
+        }
+
+        if ( ! m.query.empty()) {
+            auto const query = form::fields::of_query(req.target());
+            for (auto const& [key, value] : m.query) {
+                auto const field = query.find(key);
+                if ( ! field || ! field->value_is(value)) {
+                    return false;
+                }
+            }
+        }
+
+        if ( ! m.json_fields.empty()) {
+            boost::system::error_code ec;
+            json::value body = json::parse(req.body(), ec);
+            if (ec || ! body.is_object()) {
+                return false;
+            }
+            auto const& obj = body.as_object();
+            for (auto const& [key, value] : m.json_fields) {
+                auto const* field = obj.if_contains(key);
+                if ( ! field || ! field->is_string() || field->as_string() != value) {
+                    return false;
+                }
+            }
+        }
+
+        if ( ! m.form_fields.empty() && ! form::fields(req.body()).contains_all(m.form_fields)) {
+            return false;
+        }
+
+        return true;
+    }
+
+    std::vector<route> routes_;
+    std::unordered_map<std::string, std::vector<std::size_t>, string_hash, std::equal_to<>> exact_routes_;
+    std::vector<std::size_t> prefix_routes_;
+};
+
+//------------------------------------------------------------------------------
+
+inline string_pairs compile_pairs(json::object const& route, std::string_view key) {
+    string_pairs pairs;
+    if (auto const* obj = route.if_contains(key)) {
+        for (auto const& [name, value] : obj->as_object()) {
+            if ( ! value.is_string()) {
+                throw std::runtime_error("scenario: '" + std::string(key) + "." + std::string(name) + "' must be a string");
+            }
+            pairs.emplace_back(std::string(name), std::string(value.as_string()));
+        }
+    }
+    return pairs;
+}
+
+inline std::string serialize_response(http::response<http::string_body> res, bool keep_alive) {
+    res.keep_alive(keep_alive);
+    std::ostringstream out;
+    out << res;
+    return std::move(out).str();
+}
+
+inline route compile_route(json::object const& obj) {
+    route r;
+
+    if (auto const* method = obj.if_contains("method")) {
+        auto const verb = http::string_to_verb(method->as_string());
+        if (verb == http::verb::unknown) {
+            throw std::runtime_error("scenario: unknown method '" + std::string(method->as_string()) + "'");
+        }
+        r.match.method = verb;
+    }
+
+    if (auto const* path = obj.if_contains("path")) {
+        r.match.path = path->as_string();
+    } else if (auto const* prefix = obj.if_contains("path_prefix")) {
+        r.match.path = prefix->as_string();
+        r.match.prefix = true;
+    } else {
+        throw std::runtime_error("scenario: route without 'path' or 'path_prefix'");
+    }
+
+    if (auto const* match = obj.if_contains("match")) {
+        auto const& m = match->as_object();
+        r.match.query = compile_pairs(m, "query");
+        r.match.headers = compile_pairs(m, "headers");
+        r.match.json_fields = compile_pairs(m, "json");
+        r.match.form_fields = compile_pairs(m, "form");
+    }
+
+    auto const status = obj.if_contains("status") ? obj.at("status").to_number<unsigned>() : 200u;
+    http::response<http::string_body> res{static_cast<http::status>(status), 11};
+    res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+    for (auto const& [name, value] : compile_pairs(obj, "headers")) {
+        res.set(name, value);
+    }
+    if (auto const* body = obj.if_contains("body")) {
+        res.body() = body->as_string();
+    } else if (auto const* body_json = obj.if_contains("body_json")) {
+        res.body() = json::serialize(*body_json);
+        if (res[http::field::content_type].empty()) {
+            res.set(http::field::content_type, "application/json");
+        }
+    }
+    res.prepare_payload();
+
+    r.keep_alive_bytes = serialize_response(res, true);
+    r.close_bytes = serialize_response(std::move(res), false);
+    r.keep_alive_header_size = r.keep_alive_bytes.find("\r\n\r\n") + 4;
+    r.close_header_size = r.close_bytes.find("\r\n\r\n") + 4;
+
+    if (auto const* delay = obj.if_contains("delay_ms")) {
+        r.delay = std::chrono::milliseconds(delay->to_number<std::int64_t>());
+    }
+    if (auto const* rate = obj.if_contains("rate_bytes_per_sec")) {
+        r.rate_bytes_per_sec = rate->to_number<std::size_t>();
+    }
+    if (auto const* chunk = obj.if_contains("chunk_size")) {
+        r.chunk_size = chunk->to_number<std::size_t>();
+    }
+    return r;
+}
+
+inline std::shared_ptr<table const> compile(std::string_view text) {
+    json::value doc = json::parse(text);
+    auto const& routes = doc.as_object().at("routes").as_array();
+
+    std::vector<route> compiled;
+    compiled.reserve(routes.size());
+    for (auto const& r : routes) {
+        compiled.push_back(compile_route(r.as_object()));
+    }
+    return std::make_shared<table const>(std::move(compiled));
+}
+
+inline std::shared_ptr<table const> load(std::filesystem::path const& path) {
+    std::ifstream file(path, std::ios::binary);
+    if ( ! file) {
+        throw std::runtime_error("scenario: cannot open '" + path.string() + "'");
+    }
+    std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    return compile(text);
+}
+
+//------------------------------------------------------------------------------
+
+// Holds the published table. Readers never lock: each thread keeps its own
+// reference and only refreshes it when the generation counter moves, so a
+// reload costs one mutex acquisition per I/O thread, once. Requests already
+// in flight keep the table they started with alive through their shared_ptr.
+// The per-thread reference is shared by every store, so a process holds one.
+class store {
+public:
+    store()
+        : table_(std::make_shared<table const>())
+    {}
+
+    std::shared_ptr<table const> current() const {
+        thread_local std::uint64_t cached_generation = 0;
+        thread_local std::shared_ptr<table const> cached;
+
+        auto const generation = generation_.load(std::memory_order_acquire);
+        if (generation != cached_generation || ! cached) {
+            std::lock_guard lock(mutex_);
+            cached = table_;
+            cached_generation = generation_.load(std::memory_order_relaxed);
+        }
+        return cached;
+    }
+
+    void publish(std::shared_ptr<table const> next) {
+        std::lock_guard lock(mutex_);
+        table_ = std::move(next);
+        generation_.fetch_add(1, std::memory_order_release);
+    }
+
+private:
+    mutable std::mutex mutex_;
+    std::shared_ptr<table const> table_;
+    std::atomic<std::uint64_t> generation_{1};
+};
+
+} // namespace scenario
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <utility>
+
+#include <boost/asio/any_io_executor.hpp>
+
+#include "admission.hpp"
+#include "cookie_jar.hpp"
+#include "digest.hpp"
+#include "payload.hpp"
+#include "prefork.hpp"
+#include "proxy.hpp"
+#include "scenario.hpp"
+#include "shared_stats.hpp"
+#include "socket_tuning.hpp"
+#include "timing_wheel.hpp"
+#include "tracing.hpp"
+#include "validators.hpp"
+
+struct server_options {
+    std::filesystem::path scenario_file;
+    size_t cookie_sessions = 100000;
+    bool log_requests = true;
+    std::string cache_control = "no-cache";
+    std::filesystem::path upload_dir = ".";    // where ?sink=file uploads land
+    double clock_speedup = 1;                   // see virtual_clock
+    admission_options admission;
+    tracing_options tracing;
+    proxy_options proxy;
+    socket_tuning_options sockets;
+    prefork_options prefork;
+};
+
+// Everything a session needs besides its socket. Owned by main and outlives
+// the io_context threads.
+struct server_state {
+    server_options options;
+    scenario::store scenarios;
+    cookie_jar cookies;
+    timing_wheel_service timers;
+    payload_pool payload;
+    file_cache files;
+    digest_cache digests;
+    admission_controller admission;
+    tracer tracing;
+    std::atomic<uint64_t> connections{0};
+    std::atomic<size_t> proxied{0};            // live --proxy connections
+
+    // Set in a prefork worker: its own counters, and everyone's.
+    shared_stats::worker_slot* worker = nullptr;
+    shared_stats::segment* workers = nullptr;
+
+    server_state(server_options opts, boost::asio::any_io_executor ex, size_t threads)
+        : options(std::move(opts))
+        , cookies(options.cookie_sessions)
+        , timers(ex, threads)
+        , admission(options.admission, threads)
+        , tracing(options.tracing, threads)
+    {}
+};
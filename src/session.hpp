@@ -0,0 +1,553 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <optional>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/experimental/awaitable_operators.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/redirect_error.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/write.hpp>
+
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/beast/version.hpp>
+
+#include "multipart.hpp"
+#include "read_buffer_pool.hpp"
+#include "recycling_pool.hpp"
+#include "request_handler.hpp"
+#include "server_state.hpp"
+#include "socket_tuning.hpp"
+#include "tracing.hpp"
+#include "validators.hpp"
+#include "virtual_clock.hpp"
+
+// The per-connection coroutine and the responses it streams itself. These are
+// templates over the stream so the same code runs over a tcp::socket or an
+// in-memory transport.
+
+namespace beast = boost::beast;
+namespace http = beast::http;
+namespace net = boost::asio;
+
+using tcp = boost::asio::ip::tcp;
+
+template <typename Stream>
+net::awaitable<void> write_scenario_response(Stream& socket, server_state& state, scenario::route const& route, bool keep_alive, bool head, request_trace& trace) {
+    std::string_view response = route.response(keep_alive, head);
+    wheel_timer timer(state.timers);
+
+    if (route.delay.count() > 0) {
+        request_trace::scope phase(trace, trace_phase::delay);
+        co_await timer.async_wait(route.delay, use_pooled_awaitable);
+    }
+
+    // The canned bytes are shared; a copy is made only to carry Server-Timing
+    // or Simulated-Time.
+    std::string timed;
+    bool const simulated = virtual_clock::accelerated() && route.shaped();
+    if (trace.server_timing() || simulated) {
+        timed = response;
+        if (trace.server_timing()) {
+            splice_server_timing(timed, trace.server_timing_value());
+        }
+        if (simulated) {
+            // The field is paced with the rest, so its own length counts; a
+            // couple of rounds settle the number of digits.
+            std::string value;
+            for (int i = 0; i < 3; ++i) {
+                auto const field_size = std::string_view("Simulated-Time: \r\n").size() + value.size();
+                value = simulated_time_value(route.scheduled_time(timed.size() + field_size));
+            }
+            splice_field(timed, "Simulated-Time", value);
+        }
+        response = timed;
+    }
+    std::string_view const bytes = response;
+    request_trace::scope phase(trace, trace_phase::write);
+
+    if (route.rate_bytes_per_sec == 0 && route.chunk_size == 0) {
+        co_await net::async_write(socket, net::buffer(bytes), use_pooled_awaitable);
+        co_return;
+    }
+
+    // Shaped write: chunk_size bytes at a time, paced to rate_bytes_per_sec.
+    // Pacing is against the start time rather than per chunk, so rounding to
+    // the wheel's millisecond resolution does not accumulate.
+    auto const chunk_size = route.write_size();
+    auto const start = virtual_clock::now();
+
+    for (size_t sent = 0; sent < bytes.size(); sent += chunk_size) {
+        auto const n = std::min(chunk_size, bytes.size() - sent);
+        co_await net::async_write(socket, net::buffer(bytes.data() + sent, n), use_pooled_awaitable);
+
+        if (sent + n < bytes.size() && route.rate_bytes_per_sec != 0) {
+            auto const due = start + std::chrono::microseconds((sent + n) * 1000000 / route.rate_bytes_per_sec);
+            auto const wait = std::chrono::duration_cast<std::chrono::milliseconds>(due - virtual_clock::now());
+            if (wait.count() > 0) {
+                co_await timer.async_wait(wait, use_pooled_awaitable);
+            }
+        }
+    }
+}
+
+// Writes n bytes of generated payload, as pool slices starting at random
+// offsets. Each slice is added to the digest, if any, right before it is
+// sent, while it is still in cache for the kernel's copy.
+template <typename Stream>
+net::awaitable<void> write_payload(Stream& socket, payload_pool const& payload, std::mt19937& gen, size_t n, content_digest* digest = nullptr) {
+    while (n > 0) {
+        auto const len = std::min(n, payload_pool::pool_size);
+        auto const offset = payload_pool::random_offset(gen, len);
+        if (digest) {
+            digest->update(payload.slice(offset, len).data(), len);
+        }
+#if defined(BOOST_ASIO_HAS_IO_URING)
+        if constexpr (std::is_same_v<Stream, tcp::socket>) {
+            if (payload.registered()) {
+                co_await net::async_write(socket, payload.registered_slice(offset, len), use_pooled_awaitable);
+                n -= len;
+                continue;
+            }
+        }
+#endif
+        co_await net::async_write(socket, payload.slice(offset, len), use_pooled_awaitable);
+        n -= len;
+    }
+}
+
+// Streams /bigfile chunk by chunk. The delay between chunks is a timer wait
+// on the thread's timing wheel instead of a sleep that blocks the I/O thread.
+//
+// With Server-Timing on and a client that accepts trailers, the body is sent
+// chunked so the timing of the whole transfer can follow it as a trailer;
+// otherwise the header carries what is known before the body.
+//
+// The socket is corked while the header and each chunk's pieces are written,
+// so they leave as full segments instead of one small packet per write.
+//
+// A seeded download is reproducible: its chunk offsets come from the seed
+// instead of random_device, and it carries a strong ETag.
+//
+// With digest=<algorithm> the bytes are hashed as they are sent and the
+// Content-Digest follows in a trailer. For a seeded download whose digest is
+// already known from an earlier transfer it is sent as a header instead.
+template <typename Stream>
+net::awaitable<void> write_bigfile(Stream& socket, server_state& state, socket_tuner& tuner, bigfile_params const& params, unsigned version, bool keep_alive, bool trailers, request_trace& trace) {
+    std::optional<content_digest> digest;
+    std::optional<std::string> known_digest;
+    std::string digest_key;
+    if (params.digest) {
+        if (auto const etag = bigfile_etag(params)) {
+            digest_key = *etag + digest_name(*params.digest);
+            known_digest = state.digests.find(digest_key);
+        }
+        if ( ! known_digest) {
+            digest.emplace(*params.digest);
+        }
+    }
+
+    // The client asked for the digest by name, so it is sent as a trailer
+    // without waiting for TE: trailers.
+    bool const timing_trailer = trailers && trace.server_timing() && version == 11;
+    bool const digest_trailer = digest && version == 11;
+    bool const chunked = timing_trailer || digest_trailer;
+
+    http::response<http::empty_body> res{http::status::ok, version};
+    res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+    res.set(http::field::content_type, "application/octet-stream");
+    if (auto const etag = bigfile_etag(params)) {
+        res.set(http::field::etag, *etag);
+        if ( ! state.options.cache_control.empty()) {
+            res.set(http::field::cache_control, state.options.cache_control);
+        }
+    }
+    if (known_digest) {
+        res.set("Content-Digest", *known_digest);
+    }
+    if (chunked) {
+        res.chunked(true);
+        res.set(http::field::trailer, timing_trailer && digest_trailer ? "Server-Timing, Content-Digest" : timing_trailer ? "Server-Timing" : "Content-Digest");
+    } else {
+        res.content_length(params.total_size);
+    }
+    if (trace.server_timing() && ! timing_trailer) {
+        res.set("Server-Timing", trace.server_timing_value());
+    }
+    if (virtual_clock::accelerated()) {
+        auto const chunks = (params.total_size + params.chunk_size - 1) / params.chunk_size;
+        auto const delays = chunks > 0 ? chunks - 1 : 0;
+        res.set("Simulated-Time", simulated_time_value(std::chrono::milliseconds(delays * params.delay_ms)));
+    }
+    res.keep_alive(keep_alive);
+
+    http::response_serializer<http::empty_body> sr{res};
+    {
+        request_trace::scope phase(trace, trace_phase::write);
+        tuner.cork(socket, true);
+        co_await http::async_write_header(socket, sr, use_pooled_awaitable);
+    }
+
+    std::mt19937 gen;
+    if (params.seed) {
+        std::seed_seq seq{static_cast<uint32_t>(*params.seed), static_cast<uint32_t>(*params.seed >> 32)};
+        gen.seed(seq);
+    } else {
+        std::random_device rd;
+        gen.seed(rd());
+    }
+
+    wheel_timer timer(state.timers);
+
+    for (size_t sent = 0; sent < params.total_size; sent += params.chunk_size) {
+        auto const n = std::min(params.chunk_size, params.total_size - sent);
+        {
+            request_trace::scope phase(trace, trace_phase::write);
+            if (chunked) {
+                tuner.cork(socket, true);
+                co_await net::async_write(socket, http::chunk_header{n}, use_pooled_awaitable);
+            }
+            co_await write_payload(socket, state.payload, gen, n, digest ? &*digest : nullptr);
+            if (chunked) {
+                co_await net::async_write(socket, http::chunk_crlf{}, use_pooled_awaitable);
+            }
+            tuner.cork(socket, false);
+        }
+
+        if (sent + params.chunk_size < params.total_size && params.delay_ms > 0) {
+            request_trace::scope phase(trace, trace_phase::delay);
+            co_await timer.async_wait(std::chrono::milliseconds(params.delay_ms), use_pooled_awaitable);
+        }
+    }
+
+    if (digest && ! digest_key.empty()) {
+        state.digests.insert(digest_key, digest->field_value());
+    }
+
+    if (chunked) {
+        http::fields trailer;
+        if (timing_trailer) {
+            trailer.set("Server-Timing", trace.server_timing_value());
+        }
+        if (digest_trailer) {
+            trailer.set("Content-Digest", digest->field_value());
+        }
+        co_await net::async_write(socket, http::make_chunk_last(trailer), use_pooled_awaitable);
+    }
+
+    // With an empty body the header, and the last chunk after it, are still
+    // corked: the loop above never ran to send them.
+    tuner.cork(socket, false);
+}
+
+// Writes a handler's response. With Server-Timing on, the header is copied
+// out of the first piece the generator produces so the field can be spliced
+// in; the body that follows it is sent untouched.
+template <typename Stream>
+net::awaitable<void> write_message(Stream& socket, http::message_generator msg, request_trace& trace) {
+    if (trace.server_timing()) {
+        beast::error_code ec;
+        auto const head = msg.prepare(ec);
+        if (ec) {
+            throw beast::system_error(ec);
+        }
+        // Copy up to the blank line that ends the header, which may be split
+        // across buffers. `matched` is how much of "\r\n\r\n" the copy ends
+        // with.
+        std::string bytes;
+        std::size_t matched = 0;
+        for (auto const buffer : beast::buffers_range_ref(head)) {
+            auto const* data = static_cast<char const*>(buffer.data());
+            std::size_t n = 0;
+            while (n < buffer.size() && matched < 4) {
+                matched = data[n] == "\r\n\r\n"[matched] ? matched + 1 : (data[n] == '\r' ? 1 : 0);
+                ++n;
+            }
+            bytes.append(data, n);
+            if (matched == 4) {
+                break;
+            }
+        }
+        msg.consume(bytes.size());
+        splice_server_timing(bytes, trace.server_timing_value());
+
+        request_trace::scope phase(trace, trace_phase::write);
+        co_await net::async_write(socket, net::buffer(bytes), use_pooled_awaitable);
+        if ( ! msg.is_done()) {
+            co_await beast::async_write(socket, std::move(msg), use_pooled_awaitable);
+        }
+        co_return;
+    }
+
+    request_trace::scope phase(trace, trace_phase::write);
+    co_await beast::async_write(socket, std::move(msg), use_pooled_awaitable);
+}
+
+// Streams a multipart upload through the parser into its sinks, a fixed-size
+// chunk at a time, and answers with a JSON summary of the parts. Returns
+// whether the connection can be kept open: not after a malformed body, whose
+// remainder is left unread.
+template <typename Stream>
+net::awaitable<bool> write_upload(Stream& socket, beast::flat_buffer& buffer, http::request_parser<http::empty_body>&& header,
+                                  upload_params const& upload, server_state& state, request_trace& trace) {
+    http::request_parser<http::buffer_body> parser{std::move(header)};
+    parser.body_limit((std::numeric_limits<std::uint64_t>::max)());
+
+    multipart::part_sink sink(*upload.sink, state.options.upload_dir);
+    multipart::parser body(upload.boundary, sink);
+    std::vector<char> chunk(64 * 1024);
+
+    auto status = http::status::ok;
+    boost::json::object summary;
+    try {
+        request_trace::scope phase(trace, trace_phase::read);
+        while ( ! parser.is_done()) {
+            parser.get().body().data = chunk.data();
+            parser.get().body().size = chunk.size();
+            boost::system::error_code ec;
+            co_await http::async_read(socket, buffer, parser, net::redirect_error(use_pooled_awaitable, ec));
+            if (ec && ec != http::error::need_buffer) {
+                throw boost::system::system_error(ec);
+            }
+            body.feed({chunk.data(), chunk.size() - parser.get().body().size});
+        }
+        summary["parts"] = body.finish();
+    } catch (multipart::error const& e) {
+        status = http::status::bad_request;
+        summary["error"] = e.what();
+    }
+
+    bool const keep_alive = status == http::status::ok && parser.get().keep_alive();
+    http::response<http::string_body> res{status, parser.get().version()};
+    res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+    res.set(http::field::content_type, "application/json");
+    res.keep_alive(keep_alive);
+    res.body() = boost::json::serialize(summary);
+    res.prepare_payload();
+    co_await write_message(socket, std::move(res), trace);
+    co_return keep_alive;
+}
+
+// Whether the request's TE field lists "trailers".
+template <typename Fields>
+bool accepts_trailers(Fields const& fields) {
+    auto const te = fields[http::field::te];
+    return http::token_list(te).exists("trailers");
+}
+
+// Ends our side of the connection: a TCP half-close, or closing any other
+// transport (e.g. an in-memory stream).
+template <typename Stream>
+void shutdown_send(Stream& stream) {
+    beast::error_code ec;
+    if constexpr (requires { stream.shutdown(tcp::socket::shutdown_send, ec); }) {
+        stream.shutdown(tcp::socket::shutdown_send, ec);
+    } else {
+        stream.close();
+    }
+}
+
+// Reads and drops up to `limit` bytes, until the peer stops sending.
+template <typename Stream>
+net::awaitable<void> discard_some(Stream& stream, std::size_t limit) {
+    char scratch[16 * 1024];
+    for (std::size_t discarded = 0; discarded < limit; ) {
+        boost::system::error_code ec;
+        discarded += co_await stream.async_read_some(net::buffer(scratch), net::redirect_error(use_pooled_awaitable, ec));
+        if (ec) {
+            co_return;
+        }
+    }
+}
+
+// Drops what the client is still sending after our side has shut down, so
+// that closing the socket does not reset the connection: Linux answers a
+// close with unread data by sending an RST, and a client that gets it may
+// lose the response we just wrote. Bounded in bytes and in (real) time; other
+// transports are closed as they are.
+template <typename Stream>
+net::awaitable<void> discard_input(Stream& stream) {
+    if constexpr (requires { typename Stream::protocol_type; }) {
+        using namespace net::experimental::awaitable_operators;
+        boost::system::error_code ec;
+        net::steady_timer timeout(stream.get_executor(), std::chrono::seconds(2));
+        co_await (discard_some(stream, 1024 * 1024) || timeout.async_wait(net::redirect_error(use_pooled_awaitable, ec)));
+    }
+}
+
+// Waits until the socket has something to read, without reading it, so no
+// buffer has to be set aside for a connection that is idle. Transports
+// without readiness waits go straight to the read.
+template <typename Stream>
+net::awaitable<void> wait_readable(Stream& stream) {
+    if constexpr (requires { stream.async_wait(tcp::socket::wait_read, use_pooled_awaitable); }) {
+        co_await stream.async_wait(tcp::socket::wait_read, use_pooled_awaitable);
+    }
+}
+
+// Reads one request and writes its response; returns whether the connection
+// stays open. Everything a request needs lives in this frame, which only
+// exists while a request is being served.
+template <typename Stream>
+net::awaitable<bool> serve_request(Stream& socket, beast::flat_buffer& buffer, server_state& state, socket_tuner& tuner, request_trace::clock::time_point accepted) {
+    auto trace = state.tracing.start();
+    if (accepted != request_trace::clock::time_point{} && trace.timed()) {
+        trace.add(trace_phase::accept, accepted, request_trace::clock::now());
+    }
+
+    // The header comes first, so that a multipart upload can have
+    // its body streamed instead of buffered.
+    http::request_parser<http::empty_body> header;
+    {
+        request_trace::scope phase(trace, trace_phase::read);
+        // co_await http::async_read(stream, buffer, req);
+        co_await http::async_read_header(socket, buffer, header, use_pooled_awaitable);
+    }
+    if (state.worker) {
+        state.worker->requests.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Over the admission limit: answer with the canned 503 before
+    // doing any work for the request. A body that has not been read
+    // yet is not worth parsing, so that connection is closed, once
+    // what the client is still sending has been drained.
+    auto const ticket = state.admission.try_admit();
+    if ( ! ticket) {
+        bool keep_alive = header.get().keep_alive() && header.is_done();
+        co_await net::async_write(socket, net::buffer(state.admission.rejection(keep_alive)), use_pooled_awaitable);
+        if ( ! header.is_done()) {
+            shutdown_send(socket);
+            co_await discard_input(socket);
+        }
+        co_return keep_alive;
+    }
+
+    if (auto const upload = parse_upload_params(header.get().base())) {
+        if (state.options.log_requests) {
+            std::cout << "Request: " << header.get().target() << '\n';
+        }
+        if ( ! upload->sink) {
+            // Refused before the body is read: taking the buffered path
+            // instead would only end at the body limit.
+            http::response<http::string_body> res{http::status::bad_request, header.get().version()};
+            res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+            res.set(http::field::content_type, "text/plain");
+            res.keep_alive(false);
+            res.body() = "unknown sink";
+            res.prepare_payload();
+            tuner.use(socket, tuner.small());
+            co_await write_message(socket, std::move(res), trace);
+            shutdown_send(socket);
+            co_await discard_input(socket);
+            co_return false;
+        }
+        std::string const target = trace.sampled() ? std::string(header.get().target()) : std::string();
+        tuner.use(socket, tuner.small());
+        bool const keep_alive = co_await write_upload(socket, buffer, std::move(header), *upload, state, trace);
+        state.tracing.commit(trace, target);
+        co_return keep_alive;
+    }
+
+    http::request<http::string_body> req;
+    {
+        request_trace::scope phase(trace, trace_phase::read);
+        http::request_parser<http::string_body> parser{std::move(header)};
+        co_await http::async_read(socket, buffer, parser, use_pooled_awaitable);
+        req = parser.release();
+    }
+
+    std::string const target = trace.sampled() ? std::string(req.target()) : std::string();
+    bool keep_alive = false;
+
+    // Declarative routes take precedence. The table is pinned for the
+    // whole response so a reload cannot pull it out from under us.
+    auto const scenarios = state.scenarios.current();
+    std::optional<bigfile_params> bigfile;
+    scenario::route const* route = nullptr;
+    {
+        request_trace::scope phase(trace, trace_phase::handler);
+        route = scenarios->find(req);
+        if ( ! route) {
+            bigfile = parse_bigfile_params(req.target());
+        }
+    }
+
+    if (route) {
+        keep_alive = req.keep_alive() && req.version() == 11;
+        tuner.use(socket, route->shaped() ? tuner.stream() : tuner.small());
+        co_await write_scenario_response(socket, state, *route, keep_alive, req.method() == http::verb::head, trace);
+    } else if (bigfile) {
+        if (state.options.log_requests) {
+            std::cout << "Request: " << req.target() << '\n';
+        }
+        keep_alive = req.keep_alive();
+        auto const etag = bigfile_etag(*bigfile);
+        if (etag && not_modified(req.method(), req.base(), *etag, std::nullopt)) {
+            tuner.use(socket, tuner.small());
+            co_await write_message(socket, not_modified_response(req.version(), keep_alive, *etag, {}, state.options.cache_control), trace);
+        } else {
+            tuner.use(socket, tuner.stream());
+            co_await write_bigfile(socket, state, tuner, *bigfile, req.version(), keep_alive, accepts_trailers(req), trace);
+        }
+    } else {
+        std::optional<http::message_generator> msg;
+        {
+            request_trace::scope phase(trace, trace_phase::handler);
+            msg.emplace(handle_request(std::move(req), state));
+        }
+        keep_alive = msg->keep_alive();
+        tuner.use(socket, tuner.small());
+        // co_await beast::async_write(stream, std::move(msg), net::use_awaitable);
+        co_await write_message(socket, std::move(*msg), trace);
+    }
+
+    state.tracing.commit(trace, target);
+    co_return keep_alive;
+}
+
+// net::awaitable<void> do_session(tcp_stream stream) {
+template <typename Stream>
+net::awaitable<void> do_session(Stream socket, server_state& state, request_trace::clock::time_point accepted = {}) {
+
+    // Between requests the session holds only its socket: the read buffer is
+    // borrowed when the socket becomes readable and returned once the request
+    // is consumed, unless a pipelined request is already buffered behind it.
+    pooled_read_buffer buffer;
+
+    socket_tuner tuner(state.options.sockets);
+    tuner.accept(socket);
+
+    try {
+        for(;;) {
+            // stream.expires_after(std::chrono::seconds(30));
+            if ( ! buffer.holds_data()) {
+                buffer.release();
+                co_await wait_readable(socket);
+            }
+
+            bool const keep_alive = co_await serve_request(socket, buffer.acquire(), state, tuner, accepted);
+            accepted = {};
+
+            if ( ! keep_alive) {
+                break;
+            }
+        }
+    } catch (boost::system::system_error & se) {
+        if (se.code() != http::error::end_of_stream) {
+            throw;
+        }
+    }
+
+    // stream.socket().shutdown(tcp::socket::shutdown_send, ec);
+    shutdown_send(socket);
+}
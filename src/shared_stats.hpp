@@ -0,0 +1,97 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <system_error>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Counters shared by the processes of a prefork server.
+//
+// The segment is a memfd mapped MAP_SHARED by the master and every worker;
+// its descriptor is inherited across exec, so a master started by a rolling
+// restart maps the same counters and totals carry on through an upgrade.
+// Each worker owns one slot and is its only writer, so slots need no locking:
+// the counters are lock-free atomics, which work across processes. Anyone can
+// read every slot, which is how a worker's /__stats reports all of them.
+//
+// Slots are used in two halves that alternate between generations, so the
+// workers of a new master never share a slot with the old ones still
+// draining.
+
+namespace shared_stats {
+
+struct alignas(64) worker_slot {
+    std::atomic<std::int32_t> pid{0};           // 0 when the slot has no live worker
+    std::atomic<std::uint32_t> generation{0};
+    std::atomic<std::uint64_t> started{0};      // how many workers have run in this slot
+    std::atomic<std::uint64_t> connections{0};
+    std::atomic<std::uint64_t> requests{0};
+};
+
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free);
+static_assert(std::atomic<std::int32_t>::is_always_lock_free);
+
+struct segment {
+    static constexpr std::uint64_t current_magic = 0x7365727665720001;   // bump when the layout changes
+    static constexpr std::size_t max_workers = 128;
+
+    std::uint64_t magic;
+    std::atomic<std::uint32_t> generation{0};
+    std::atomic<std::uint64_t> crashes{0};
+    worker_slot slots[2 * max_workers];
+
+    worker_slot& slot(std::uint32_t generation, std::size_t worker) {
+        return slots[(generation % 2) * max_workers + worker];
+    }
+};
+
+struct totals {
+    std::size_t live_workers = 0;
+    std::uint64_t connections = 0;
+    std::uint64_t requests = 0;
+    std::uint64_t started = 0;
+};
+
+inline totals sum(segment const& s) {
+    totals t;
+    for (auto const& slot : s.slots) {
+        t.live_workers += slot.pid.load(std::memory_order_relaxed) != 0;
+        t.connections += slot.connections.load(std::memory_order_relaxed);
+        t.requests += slot.requests.load(std::memory_order_relaxed);
+        t.started += slot.started.load(std::memory_order_relaxed);
+    }
+    return t;
+}
+
+#if defined(__linux__)
+// Maps the segment behind fd, or a new one if fd is -1. A segment written by
+// a binary with a different layout is started afresh.
+inline segment* map(int& fd) {
+    bool const created = fd < 0;
+    if (created) {
+        fd = ::memfd_create("server-stats", 0);
+        if (fd < 0 || ::ftruncate(fd, sizeof(segment)) != 0) {
+            throw std::system_error(errno, std::generic_category(), "shared stats");
+        }
+    }
+    void* p = ::mmap(nullptr, sizeof(segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        throw std::system_error(errno, std::generic_category(), "shared stats");
+    }
+    auto* s = static_cast<segment*>(p);
+    if (created || s->magic != segment::current_magic) {
+        s = new (p) segment{};
+        s->magic = segment::current_magic;
+    }
+    return s;
+}
+#endif
+
+} // namespace shared_stats
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstddef>
+#include <type_traits>
+
+#include <boost/asio/ip/tcp.hpp>
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#endif
+
+// Socket options per kind of response.
+//
+// Accepted sockets get the "small" profile: TCP_NODELAY, so a short response
+// is not held back by Nagle waiting for the ACK of the previous one. Routes
+// that stream a body (/bigfile, shaped scenario routes) switch their socket to
+// the "stream" profile for the response: a small SO_SNDBUF and
+// TCP_NOTSENT_LOWAT keep only a little unsent data in the kernel, so the
+// writer's pacing and delays reach the wire instead of being absorbed by a
+// multi-megabyte send buffer. While a streamed response writes its header and
+// the start of a chunk, TCP_CORK holds the small pieces so they leave in full
+// segments together with the payload.
+//
+// A connection remembers what it last set, and only options that differ
+// from it are changed. SO_SNDBUF, once set, turns off the kernel's send
+// buffer autotuning for the socket; the small profile leaves it alone.
+//
+// Off unless asked for: measured over loopback it gained neither request
+// rate, bulk throughput nor pacing accuracy (see bench/socket_tuning.sh).
+
+namespace net = boost::asio;
+
+using tcp = boost::asio::ip::tcp;
+
+struct socket_profile {
+    bool no_delay = true;
+    bool cork = false;
+    std::size_t send_buffer = 0;        // SO_SNDBUF, 0 leaves the kernel default
+    std::size_t notsent_lowat = 0;      // TCP_NOTSENT_LOWAT, 0 is the sysctl default
+};
+
+struct socket_tuning_options {
+    bool enabled = false;
+    socket_profile small{};
+    socket_profile stream{true, true, 256 * 1024, 16 * 1024};
+};
+
+class socket_tuner {
+public:
+    explicit socket_tuner(socket_tuning_options const& options)
+        : options_(options)
+    {}
+
+    socket_profile const& small() const {
+        return options_.small;
+    }
+
+    socket_profile const& stream() const {
+        return options_.stream;
+    }
+
+    // Applies the accept-time profile.
+    template <typename Stream>
+    void accept(Stream& socket) {
+        use(socket, options_.small);
+    }
+
+    template <typename Stream>
+    void use(Stream& socket, socket_profile const& profile) {
+        if constexpr (std::is_same_v<Stream, tcp::socket>) {
+            if ( ! options_.enabled) {
+                return;
+            }
+            boost::system::error_code ec;
+            if ( ! applied_ || no_delay_ != profile.no_delay) {
+                socket.set_option(tcp::no_delay(profile.no_delay), ec);
+                no_delay_ = profile.no_delay;
+            }
+            if (profile.send_buffer != 0 && profile.send_buffer != send_buffer_) {
+                socket.set_option(net::socket_base::send_buffer_size(static_cast<int>(profile.send_buffer)), ec);
+                send_buffer_ = profile.send_buffer;
+            }
+#if defined(TCP_NOTSENT_LOWAT)
+            if (profile.notsent_lowat != notsent_lowat_) {
+                set_int(socket, IPPROTO_TCP, TCP_NOTSENT_LOWAT, static_cast<int>(profile.notsent_lowat));
+                notsent_lowat_ = profile.notsent_lowat;
+            }
+#endif
+            // Whatever a corking profile still holds goes out before it is
+            // left.
+            if (corked_ && ! profile.cork) {
+                cork(socket, false);
+            }
+            cork_ = profile.cork;
+            applied_ = true;
+        } else {
+            (void)socket;
+            (void)profile;
+        }
+    }
+
+    // Holds partial segments while the pieces of a response are written; a
+    // no-op unless the current profile corks. Uncorking sends what is held.
+    template <typename Stream>
+    void cork(Stream& socket, bool on) {
+#if defined(TCP_CORK)
+        if constexpr (std::is_same_v<Stream, tcp::socket>) {
+            if (cork_ && corked_ != on) {
+                set_int(socket, IPPROTO_TCP, TCP_CORK, on ? 1 : 0);
+                corked_ = on;
+            }
+            return;
+        }
+#endif
+        (void)socket;
+        (void)on;
+    }
+
+private:
+#if defined(TCP_NOTSENT_LOWAT) || defined(TCP_CORK)
+    static void set_int(tcp::socket& socket, int level, int name, int value) {
+        // Best effort: a socket that refuses an option is still usable.
+        ::setsockopt(socket.native_handle(), level, name, &value, sizeof(value));
+    }
+#endif
+
+    socket_tuning_options const& options_;
+    bool applied_ = false;
+    bool no_delay_ = false;
+    std::size_t send_buffer_ = 0;
+    std::size_t notsent_lowat_ = 0;
+    bool cork_ = false;
+    bool corked_ = false;
+};
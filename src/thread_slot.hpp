@@ -0,0 +1,20 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+// Which of n per-thread shards the calling thread uses: timing wheels,
+// admission counters and trace buffers all keep one shard per I/O thread.
+// Threads are numbered round-robin the first time they ask and keep their
+// number, so a thread lands on the same index in every sharded structure.
+
+class thread_slot {
+public:
+    static std::size_t index(std::size_t shards) {
+        thread_local std::size_t const number = next_.fetch_add(1, std::memory_order_relaxed);
+        return number % shards;
+    }
+
+private:
+    static inline std::atomic<std::size_t> next_{0};
+};
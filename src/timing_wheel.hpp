@@ -0,0 +1,348 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <boost/asio/any_completion_handler.hpp>
+#include <boost/asio/any_io_executor.hpp>
+#include <boost/asio/append.hpp>
+#include <boost/asio/associated_executor.hpp>
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/error.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+#include "thread_slot.hpp"
+#include "virtual_clock.hpp"
+
+// Millisecond timers for delays and timeouts that do not go through asio's
+// timer heap.
+//
+// Each wheel is hierarchical (four levels of 64 slots, covering about 4.6
+// hours before a timer is parked in the last slot and re-cascaded), so
+// schedule and cancel are O(1) list operations. The wheel owns a single
+// steady_timer that wakes it on the next occupied millisecond, found in a
+// bitmap of level-0 slots, or on the next level-0 revolution when coarser
+// timers are pending; that is the only entry the wheel puts in asio's
+// scheduler no matter how many timers it holds.
+//
+// Milliseconds are virtual_clock milliseconds; only the steady_timer's expiry
+// is converted to real time.
+//
+// timing_wheel_service keeps one wheel per I/O thread. A timer joins the wheel
+// of the thread that started the wait, so wheels are rarely touched by more
+// than one thread and their mutexes stay uncontended.
+
+namespace net = boost::asio;
+
+struct wheel_node {
+    wheel_node* prev = nullptr;
+    wheel_node* next = nullptr;
+    std::uint64_t deadline = 0;
+    unsigned level = 0;
+    net::any_completion_handler<void(boost::system::error_code)> handler;
+
+    bool linked() const {
+        return prev != nullptr;
+    }
+};
+
+class timing_wheel {
+public:
+    using clock = virtual_clock;
+    using handler_type = net::any_completion_handler<void(boost::system::error_code)>;
+
+    static constexpr unsigned levels = 4;
+    static constexpr unsigned slot_bits = 6;
+    static constexpr std::uint64_t slots = std::uint64_t(1) << slot_bits;
+    static constexpr std::uint64_t slot_mask = slots - 1;
+    static constexpr std::uint64_t span = std::uint64_t(1) << (slot_bits * levels);
+
+    static_assert(slots == 64, "occupied_ has a bit per level-0 slot");
+
+    explicit timing_wheel(net::any_io_executor ex)
+        : ticker_(std::move(ex))
+        , epoch_(clock::now())
+    {
+        for (auto& level : slots_) {
+            for (auto& head : level) {
+                head.prev = &head;
+                head.next = &head;
+            }
+        }
+    }
+
+    timing_wheel(timing_wheel const&) = delete;
+    timing_wheel& operator=(timing_wheel const&) = delete;
+
+    // Pending handlers are destroyed without being invoked. They may own
+    // coroutine frames whose timers call cancel() from their destructors, so
+    // every node is unlinked before any handler goes away.
+    ~timing_wheel() {
+        std::vector<handler_type> orphans;
+        {
+            std::lock_guard lock(mutex_);
+            for (auto& level : slots_) {
+                for (auto& head : level) {
+                    while (head.next != &head) {
+                        auto* node = head.next;
+                        unlink(*node);
+                        orphans.push_back(std::move(node->handler));
+                    }
+                }
+            }
+            pending_ = 0;
+        }
+    }
+
+    void schedule(wheel_node& node, std::chrono::milliseconds delay, handler_type handler) {
+        std::lock_guard lock(mutex_);
+
+        auto const now = elapsed();
+        if (pending_ == 0 && now > now_) {
+            now_ = now;
+        }
+        auto const ms = static_cast<std::uint64_t>(std::max<std::int64_t>(0, delay.count()));
+        node.deadline = std::max(now + ms, now_ + 1);
+        node.handler = std::move(handler);
+        insert(node);
+        ++pending_;
+        arm();
+    }
+
+    bool cancel(wheel_node& node) {
+        handler_type handler;
+        {
+            std::lock_guard lock(mutex_);
+            if ( ! node.linked()) {
+                return false;
+            }
+            unlink(node);
+            --pending_;
+            handler = std::move(node.handler);
+        }
+        complete(std::move(handler), net::error::operation_aborted);
+        return true;
+    }
+
+    std::size_t pending() const {
+        std::lock_guard lock(mutex_);
+        return pending_;
+    }
+
+private:
+    // Handlers never run inside the wheel's lock; they are posted to their
+    // own executor, or the wheel's when they have none.
+    void complete(handler_type handler, boost::system::error_code ec) {
+        auto ex = net::get_associated_executor(handler, ticker_.get_executor());
+        net::post(ex, net::append(std::move(handler), ec));
+    }
+
+    std::uint64_t elapsed() const {
+        return static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::milliseconds>(clock::now() - epoch_).count());
+    }
+
+    static void link(wheel_node& head, wheel_node& node) {
+        node.prev = head.prev;
+        node.next = &head;
+        head.prev->next = &node;
+        head.prev = &node;
+    }
+
+    void unlink(wheel_node& node) {
+        node.prev->next = node.next;
+        node.next->prev = node.prev;
+        node.prev = nullptr;
+        node.next = nullptr;
+        --count_[node.level];
+        // A level-0 node sits in the slot of its deadline.
+        if (node.level == 0) {
+            auto const index = node.deadline & slot_mask;
+            if (slots_[0][index].next == &slots_[0][index]) {
+                occupied_ &= ~(std::uint64_t(1) << index);
+            }
+        }
+    }
+
+    void insert(wheel_node& node) {
+        auto const delta = node.deadline - now_;
+        unsigned level = 0;
+        while (level + 1 < levels && delta >= (std::uint64_t(1) << (slot_bits * (level + 1)))) {
+            ++level;
+        }
+        // Beyond the top level's reach: park in its furthest slot and let the
+        // cascade re-insert it.
+        auto const when = delta < span ? node.deadline : now_ + span - 1;
+        node.level = level;
+        link(slots_[level][(when >> (slot_bits * level)) & slot_mask], node);
+        ++count_[level];
+        if (level == 0) {
+            occupied_ |= std::uint64_t(1) << (when & slot_mask);
+        }
+    }
+
+    void cascade(unsigned level, std::uint64_t index) {
+        auto& head = slots_[level][index];
+        while (head.next != &head) {
+            auto* node = head.next;
+            unlink(*node);
+            insert(*node);
+        }
+    }
+
+    void advance(std::uint64_t target, std::vector<handler_type>& fired) {
+        while (now_ < target) {
+            if (pending_ == 0) {
+                now_ = target;
+                break;
+            }
+            // Nothing due at level 0: skip ahead to the next revolution,
+            // where coarser slots cascade.
+            if (count_[0] == 0) {
+                auto const boundary = (now_ | slot_mask) + 1;
+                if (boundary > target) {
+                    now_ = target;
+                    break;
+                }
+                now_ = boundary - 1;
+            }
+
+            ++now_;
+            for (unsigned level = 1; level < levels; ++level) {
+                if ((now_ & ((std::uint64_t(1) << (slot_bits * level)) - 1)) != 0) {
+                    break;
+                }
+                cascade(level, (now_ >> (slot_bits * level)) & slot_mask);
+            }
+
+            auto& head = slots_[0][now_ & slot_mask];
+            while (head.next != &head) {
+                auto* node = head.next;
+                unlink(*node);
+                if (node->deadline > now_) {
+                    insert(*node);
+                    continue;
+                }
+                --pending_;
+                fired.push_back(std::move(node->handler));
+            }
+        }
+    }
+
+    // Called with the mutex held.
+    void arm() {
+        if (pending_ == 0) {
+            return;
+        }
+        // The next occupied level-0 slot, at most a revolution ahead, or the
+        // end of this revolution when coarser timers have to cascade.
+        auto wake = (now_ | slot_mask) + 1;
+        if (occupied_ != 0) {
+            auto const first = (now_ + 1) & slot_mask;
+            auto const next = now_ + 1 + static_cast<std::uint64_t>(std::countr_zero(std::rotr(occupied_, static_cast<int>(first))));
+            if (count_[0] == pending_ || next < wake) {
+                wake = next;
+            }
+        }
+        if (armed_ && wake >= armed_wake_) {
+            return;
+        }
+        armed_ = true;
+        armed_wake_ = wake;
+        auto const generation = ++arm_generation_;
+        ticker_.expires_at(clock::to_real(epoch_ + std::chrono::milliseconds(wake)));
+        ticker_.async_wait([this, generation](boost::system::error_code) {
+            on_tick(generation);
+        });
+    }
+
+    void on_tick(std::uint64_t generation) {
+        std::vector<handler_type> fired;
+        {
+            std::lock_guard lock(mutex_);
+            if (generation != arm_generation_) {
+                return;     // superseded by an earlier wake-up
+            }
+            armed_ = false;
+            advance(elapsed(), fired);
+            arm();
+        }
+        for (auto& handler : fired) {
+            complete(std::move(handler), {});
+        }
+    }
+
+    mutable std::mutex mutex_;
+    std::array<std::array<wheel_node, slots>, levels> slots_;
+    std::array<std::size_t, levels> count_{};
+    std::uint64_t occupied_ = 0;        // bit i: slots_[0][i] is not empty
+    std::size_t pending_ = 0;
+    std::uint64_t now_ = 0;
+
+    net::steady_timer ticker_;
+    clock::time_point const epoch_;
+    bool armed_ = false;
+    std::uint64_t armed_wake_ = 0;
+    std::uint64_t arm_generation_ = 0;
+};
+
+//------------------------------------------------------------------------------
+
+class timing_wheel_service {
+public:
+    timing_wheel_service(net::any_io_executor ex, std::size_t wheels) {
+        wheels_.reserve(std::max<std::size_t>(1, wheels));
+        for (std::size_t i = 0; i < std::max<std::size_t>(1, wheels); ++i) {
+            wheels_.push_back(std::make_unique<timing_wheel>(ex));
+        }
+    }
+
+    // The wheel owned by the calling thread.
+    timing_wheel& local() {
+        return *wheels_[thread_slot::index(wheels_.size())];
+    }
+
+private:
+    std::vector<std::unique_ptr<timing_wheel>> wheels_;
+};
+
+// A timer with the shape of a one-shot steady_timer, scheduled on the calling
+// thread's wheel. Starting a new wait cancels the previous one.
+class wheel_timer {
+public:
+    explicit wheel_timer(timing_wheel_service& service)
+        : service_(service)
+    {}
+
+    wheel_timer(wheel_timer const&) = delete;
+    wheel_timer& operator=(wheel_timer const&) = delete;
+
+    ~wheel_timer() {
+        cancel();
+    }
+
+    template <typename CompletionToken>
+    auto async_wait(std::chrono::milliseconds delay, CompletionToken&& token) {
+        return net::async_initiate<CompletionToken, void(boost::system::error_code)>(
+            [this](auto handler, std::chrono::milliseconds delay) {
+                cancel();
+                wheel_ = &service_.local();
+                wheel_->schedule(node_, delay, std::move(handler));
+            }, token, delay);
+    }
+
+    bool cancel() {
+        return wheel_ != nullptr && wheel_->cancel(node_);
+    }
+
+private:
+    timing_wheel_service& service_;
+    timing_wheel* wheel_ = nullptr;
+    wheel_node node_;
+};
@@ -0,0 +1,286 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <boost/json.hpp>
+
+#include "thread_slot.hpp"
+
+// Per-request phase timing.
+//
+// A request_trace accumulates how long a request spent in each phase of
+// do_session: waiting for and reading the request, the handler, timer delays
+// and writing the response. The totals become a Server-Timing header, or a
+// trailer when the body is streamed chunked. One request in sample_every is
+// also kept span by span in a per-thread ring buffer, which /__trace exports
+// as Chrome trace-event JSON for chrome://tracing or Perfetto.
+//
+// Timestamps come from steady_clock, a vDSO clock_gettime on Linux. Nothing is
+// read from the clock unless timing or sampling is turned on.
+
+struct tracing_options {
+    bool server_timing = false;
+    std::uint32_t sample_every = 0;       // 0 disables sampling
+    std::size_t events_per_thread = 65536;
+};
+
+enum class trace_phase : std::uint8_t {
+    accept,
+    read,
+    handler,
+    delay,
+    write,
+};
+
+inline constexpr std::array<char const*, 5> trace_phase_names = {
+    "accept", "read", "handler", "delay", "write",
+};
+
+class request_trace {
+public:
+    using clock = std::chrono::steady_clock;
+
+    struct span {
+        trace_phase phase;
+        clock::time_point begin;
+        clock::time_point end;
+    };
+
+    // Ends its phase when it goes out of scope.
+    class scope {
+    public:
+        scope(request_trace& trace, trace_phase phase)
+            : trace_(trace.timed() ? &trace : nullptr)
+            , phase_(phase)
+            , begin_(trace_ ? clock::now() : clock::time_point{})
+        {}
+
+        scope(scope const&) = delete;
+        scope& operator=(scope const&) = delete;
+
+        ~scope() {
+            if (trace_) {
+                trace_->add(phase_, begin_, clock::now());
+            }
+        }
+
+    private:
+        request_trace* trace_;
+        trace_phase phase_;
+        clock::time_point begin_;
+    };
+
+    static constexpr std::size_t max_spans = 64;
+
+    request_trace() = default;
+
+    request_trace(bool server_timing, bool sampled)
+        : server_timing_(server_timing)
+        , sampled_(sampled)
+    {
+        if (sampled_) {
+            spans_.reserve(16);
+        }
+    }
+
+    bool timed() const {
+        return server_timing_ || sampled_;
+    }
+
+    bool server_timing() const {
+        return server_timing_;
+    }
+
+    bool sampled() const {
+        return sampled_;
+    }
+
+    void add(trace_phase phase, clock::time_point begin, clock::time_point end) {
+        totals_[static_cast<std::size_t>(phase)] += end - begin;
+        if (sampled_ && spans_.size() < max_spans) {
+            spans_.push_back({phase, begin, end});
+        }
+    }
+
+    std::vector<span> const& spans() const {
+        return spans_;
+    }
+
+    // "read;dur=0.042, handler;dur=0.013", in milliseconds, phases that did
+    // not occur left out.
+    std::string server_timing_value() const {
+        std::string out;
+        for (std::size_t i = 0; i < totals_.size(); ++i) {
+            if (totals_[i] == clock::duration::zero()) {
+                continue;
+            }
+            char buf[64];
+            auto const ms = std::chrono::duration<double, std::milli>(totals_[i]).count();
+            auto const n = std::snprintf(buf, sizeof(buf), "%s%s;dur=%.3f", out.empty() ? "" : ", ", trace_phase_names[i], ms);
+            out.append(buf, static_cast<std::size_t>(n));
+        }
+        return out;
+    }
+
+private:
+    bool server_timing_ = false;
+    bool sampled_ = false;
+    std::array<clock::duration, trace_phase_names.size()> totals_{};
+    std::vector<span> spans_;
+};
+
+// Adds a field to a serialized response, before the blank line that ends its
+// header.
+inline void splice_field(std::string& response, std::string_view name, std::string_view value) {
+    auto const end = response.find("\r\n\r\n");
+    if (end == std::string::npos) {
+        return;
+    }
+    std::string field(name);
+    field += ": ";
+    field += value;
+    field += "\r\n";
+    response.insert(end + 2, field);
+}
+
+inline void splice_server_timing(std::string& response, std::string_view value) {
+    splice_field(response, "Server-Timing", value);
+}
+
+class tracer {
+public:
+    tracer(tracing_options options, std::size_t threads)
+        : options_(options)
+        , epoch_(request_trace::clock::now())
+    {
+        if (options_.sample_every == 0) {
+            return;
+        }
+        buffers_.reserve(std::max<std::size_t>(1, threads));
+        for (std::size_t i = 0; i < std::max<std::size_t>(1, threads); ++i) {
+            buffers_.push_back(std::make_unique<thread_buffer>(i, options_.events_per_thread));
+        }
+    }
+
+    tracing_options const& options() const {
+        return options_;
+    }
+
+    request_trace start() {
+        if ( ! options_.server_timing && options_.sample_every == 0) {
+            return {};
+        }
+        bool sampled = false;
+        if (options_.sample_every != 0) {
+            thread_local std::uint32_t counter = 0;
+            sampled = ++counter % options_.sample_every == 0;
+        }
+        return request_trace(options_.server_timing, sampled);
+    }
+
+    // Records a finished sampled request in the calling thread's buffer.
+    void commit(request_trace const& trace, std::string_view target) {
+        if ( ! trace.sampled() || trace.spans().empty()) {
+            return;
+        }
+        auto& buffer = local();
+        auto const id = next_request_.fetch_add(1, std::memory_order_relaxed);
+
+        std::lock_guard lock(buffer.mutex);
+        auto const& spans = trace.spans();
+        auto const begin = spans.front().begin;
+        auto const end = std::max_element(spans.begin(), spans.end(), [](auto const& a, auto const& b) {
+            return a.end < b.end;
+        })->end;
+        buffer.push({nullptr, std::string(target), micros(begin), micros(end) - micros(begin), id});
+        for (auto const& s : spans) {
+            buffer.push({trace_phase_names[static_cast<std::size_t>(s.phase)], {}, micros(s.begin), micros(s.end) - micros(s.begin), id});
+        }
+    }
+
+    // Everything currently buffered, as a Chrome trace-event document.
+    std::string export_chrome_json() {
+        boost::json::array events;
+        for (auto const& buffer : buffers_) {
+            std::lock_guard lock(buffer->mutex);
+            buffer->for_each([&](trace_event const& e) {
+                boost::json::object event;
+                event["name"] = e.name ? boost::json::string(e.name) : boost::json::string(e.target);
+                event["cat"] = e.name ? "phase" : "request";
+                event["ph"] = "X";
+                event["ts"] = e.ts_us;
+                event["dur"] = e.dur_us;
+                event["pid"] = 1;
+                event["tid"] = buffer->index;
+                event["args"] = boost::json::object{{"request", e.request_id}};
+                events.push_back(std::move(event));
+            });
+        }
+        boost::json::object doc;
+        doc["traceEvents"] = std::move(events);
+        doc["displayTimeUnit"] = "ms";
+        return boost::json::serialize(doc);
+    }
+
+private:
+    struct trace_event {
+        char const* name;           // phase name, or null for the enclosing request
+        std::string target;         // request target, for the enclosing request only
+        std::int64_t ts_us;
+        std::int64_t dur_us;
+        std::uint64_t request_id;
+    };
+
+    // A ring of the most recent events. The mutex is only ever contended by
+    // an export.
+    struct thread_buffer {
+        thread_buffer(std::size_t index, std::size_t capacity)
+            : index(index)
+            , events(std::max<std::size_t>(1, capacity))
+        {}
+
+        void push(trace_event e) {
+            events[head] = std::move(e);
+            head = (head + 1) % events.size();
+            count = std::min(count + 1, events.size());
+        }
+
+        template <typename F>
+        void for_each(F&& f) const {
+            auto const first = (head + events.size() - count) % events.size();
+            for (std::size_t i = 0; i < count; ++i) {
+                f(events[(first + i) % events.size()]);
+            }
+        }
+
+        std::size_t const index;
+        std::mutex mutex;
+        std::vector<trace_event> events;
+        std::size_t head = 0;
+        std::size_t count = 0;
+    };
+
+    thread_buffer& local() {
+        return *buffers_[thread_slot::index(buffers_.size())];
+    }
+
+    std::int64_t micros(request_trace::clock::time_point t) const {
+        return std::chrono::duration_cast<std::chrono::microseconds>(t - epoch_).count();
+    }
+
+    tracing_options options_;
+    request_trace::clock::time_point epoch_;
+    std::vector<std::unique_ptr<thread_buffer>> buffers_;
+    std::atomic<std::uint64_t> next_request_{0};
+};
@@ -0,0 +1,226 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/beast/version.hpp>
+
+// Validators for conditional requests: strong ETags, Last-Modified dates, and
+// the If-None-Match / If-Modified-Since checks that turn a request into a
+// bodyless 304.
+//
+// Files are read once into a file_cache and served from memory with their
+// ETag and Last-Modified computed at load time; the cache reloads a file when
+// its size or modification time changes. A revalidation therefore costs two
+// stat calls and a header write.
+
+namespace http = boost::beast::http;
+
+inline std::string_view to_string_view(boost::beast::string_view s) {
+    return {s.data(), s.size()};
+}
+
+inline boost::beast::string_view to_beast_string_view(std::string_view s) {
+    return {s.data(), s.size()};
+}
+
+// IMF-fixdate, "Sun, 06 Nov 1994 08:49:37 GMT".
+inline std::optional<std::chrono::system_clock::time_point> parse_http_date(std::string_view date) {
+    std::tm tm{};
+    std::istringstream in{std::string(date)};
+    in >> std::get_time(&tm, "%a, %d %b %Y %H:%M:%S GMT");
+    if (in.fail()) {
+        return std::nullopt;
+    }
+    return std::chrono::system_clock::from_time_t(timegm(&tm));
+}
+
+inline std::string format_http_date(std::chrono::system_clock::time_point t) {
+    auto const time = std::chrono::system_clock::to_time_t(t);
+    std::tm tm{};
+    gmtime_r(&time, &tm);
+    char buf[64];
+    auto const n = std::strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    return std::string(buf, n);
+}
+
+// A strong entity tag for a byte string: 64-bit FNV-1a plus the length.
+inline std::string make_etag(std::string_view bytes) {
+    std::uint64_t hash = 0xcbf29ce484222325;
+    for (unsigned char const c : bytes) {
+        hash ^= c;
+        hash *= 0x100000001b3;
+    }
+    char buf[48];
+    auto const n = std::snprintf(buf, sizeof(buf), "\"%016llx-%zx\"", static_cast<unsigned long long>(hash), bytes.size());
+    return std::string(buf, static_cast<std::size_t>(n));
+}
+
+// Whether an If-None-Match value lists etag. Uses the weak comparison RFC
+// 9110 prescribes for If-None-Match: a W/ prefix is ignored.
+inline bool etag_list_matches(std::string_view list, std::string_view etag) {
+    while ( ! list.empty()) {
+        auto const comma = list.find(',');
+        auto tag = list.substr(0, comma);
+        list = comma == std::string_view::npos ? std::string_view{} : list.substr(comma + 1);
+
+        while ( ! tag.empty() && (tag.front() == ' ' || tag.front() == '\t')) {
+            tag.remove_prefix(1);
+        }
+        while ( ! tag.empty() && (tag.back() == ' ' || tag.back() == '\t')) {
+            tag.remove_suffix(1);
+        }
+        if (tag == "*") {
+            return true;
+        }
+        if (tag.starts_with("W/")) {
+            tag.remove_prefix(2);
+        }
+        if (tag == etag) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Whether a GET or HEAD can be answered with 304 Not Modified. If-None-Match
+// takes precedence; If-Modified-Since is only consulted without it.
+template <typename Fields>
+bool not_modified(http::verb method, Fields const& fields, std::string_view etag,
+                  std::optional<std::chrono::system_clock::time_point> last_modified) {
+    if (method != http::verb::get && method != http::verb::head) {
+        return false;
+    }
+    if (auto const it = fields.find(http::field::if_none_match); it != fields.end()) {
+        return ! etag.empty() && etag_list_matches(to_string_view(it->value()), etag);
+    }
+    if (auto const it = fields.find(http::field::if_modified_since); it != fields.end() && last_modified) {
+        auto const since = parse_http_date(to_string_view(it->value()));
+        return since && std::chrono::floor<std::chrono::seconds>(*last_modified) <= *since;
+    }
+    return false;
+}
+
+// The 304 for a representation: its validators and caching policy, no body.
+inline http::response<http::empty_body> not_modified_response(unsigned version, bool keep_alive, std::string_view etag,
+                                                              std::string_view last_modified, std::string_view cache_control) {
+    http::response<http::empty_body> res{http::status::not_modified, version};
+    res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+    if ( ! etag.empty()) {
+        res.set(http::field::etag, to_beast_string_view(etag));
+    }
+    if ( ! last_modified.empty()) {
+        res.set(http::field::last_modified, to_beast_string_view(last_modified));
+    }
+    if ( ! cache_control.empty()) {
+        res.set(http::field::cache_control, to_beast_string_view(cache_control));
+    }
+    res.keep_alive(keep_alive);
+    return res;
+}
+
+// A response body that shares an immutable buffer instead of copying it, so
+// every response for a cached file points at the same bytes.
+struct shared_buffer_body {
+    using value_type = std::shared_ptr<std::string const>;
+
+    static std::uint64_t size(value_type const& body) {
+        return body ? body->size() : 0;
+    }
+
+    class writer {
+    public:
+        using const_buffers_type = boost::asio::const_buffer;
+
+        template <bool isRequest, typename Fields>
+        writer(http::header<isRequest, Fields> const&, value_type const& body)
+            : body_(body)
+        {}
+
+        void init(boost::beast::error_code& ec) {
+            ec = {};
+        }
+
+        boost::optional<std::pair<const_buffers_type, bool>> get(boost::beast::error_code& ec) {
+            ec = {};
+            if (done_ || ! body_) {
+                return boost::none;
+            }
+            done_ = true;
+            return {{boost::asio::buffer(*body_), false}};
+        }
+
+    private:
+        value_type const& body_;
+        bool done_ = false;
+    };
+};
+
+struct cached_file {
+    std::shared_ptr<std::string const> data;
+    std::string etag;
+    std::string last_modified;
+    std::chrono::system_clock::time_point modified;
+    std::filesystem::file_time_type write_time;
+};
+
+class file_cache {
+public:
+    // The file's current contents, or null if it cannot be read.
+    std::shared_ptr<cached_file const> get(std::filesystem::path const& path) {
+        std::error_code ec;
+        auto const write_time = std::filesystem::last_write_time(path, ec);
+        if (ec) {
+            return nullptr;
+        }
+        auto const size = std::filesystem::file_size(path, ec);
+        if (ec) {
+            return nullptr;
+        }
+
+        {
+            std::lock_guard lock(mutex_);
+            auto const it = entries_.find(path.string());
+            if (it != entries_.end() && it->second->write_time == write_time && it->second->data->size() == size) {
+                return it->second;
+            }
+        }
+
+        std::ifstream file(path, std::ios::binary);
+        if ( ! file) {
+            return nullptr;
+        }
+        auto data = std::make_shared<std::string>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+        auto entry = std::make_shared<cached_file>();
+        entry->etag = make_etag(*data);
+        entry->data = std::move(data);
+        entry->modified = std::chrono::floor<std::chrono::seconds>(std::chrono::file_clock::to_sys(write_time));
+        entry->last_modified = format_http_date(entry->modified);
+        entry->write_time = write_time;
+
+        std::lock_guard lock(mutex_);
+        entries_[path.string()] = entry;
+        return entry;
+    }
+
+private:
+    std::mutex mutex_;
+    std::unordered_map<std::string, std::shared_ptr<cached_file const>> entries_;
+};
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <string>
+
+// The clock behind delays, shaping and timeouts, which can run faster than
+// real time.
+//
+// With --clock-speedup=100 a second of virtual time passes in 10 ms: a route
+// with delay_ms=5000 answers after 50 ms, and a 1 MB/s shaped route sends
+// 100 MB per real second. Everything that waits or paces reads this clock
+// instead of steady_clock, and the timing wheel converts its deadlines back to
+// real time only to arm its one steady_timer, so delays keep their relative
+// order and spacing at any speed. Tracing, Server-Timing, admission control
+// and drain timeouts stay on real time.
+//
+// Responses whose timing is simulated carry a Simulated-Time field with the
+// virtual time their delays and pacing are scheduled to take, computed from
+// the request and route rather than measured, so it is the same on every run.
+//
+// The speed-up is set once at startup, before any thread reads the clock.
+
+class virtual_clock {
+public:
+    using rep = std::chrono::steady_clock::rep;
+    using period = std::chrono::steady_clock::period;
+    using duration = std::chrono::steady_clock::duration;
+    using time_point = std::chrono::time_point<virtual_clock>;
+
+    static constexpr bool is_steady = true;
+
+    static void set_speedup(double speedup) {
+        speedup_ = speedup;
+    }
+
+    static double speedup() {
+        return speedup_;
+    }
+
+    static bool accelerated() {
+        return speedup_ != 1;
+    }
+
+    static time_point now() noexcept {
+        return from_real(std::chrono::steady_clock::now());
+    }
+
+    static time_point from_real(std::chrono::steady_clock::time_point t) {
+        return time_point(scale(t - epoch_, speedup_));
+    }
+
+    // Rounded up, so that once the real time has passed so has the virtual.
+    static std::chrono::steady_clock::time_point to_real(time_point t) {
+        return epoch_ + scale(t.time_since_epoch(), 1 / speedup_, true);
+    }
+
+    // How long a virtual duration lasts in real time.
+    static std::chrono::steady_clock::duration to_real(duration d) {
+        return scale(d, 1 / speedup_);
+    }
+
+    // How much virtual time passes in a real duration.
+    static duration from_real(std::chrono::steady_clock::duration d) {
+        return scale(d, speedup_);
+    }
+
+private:
+    static duration scale(duration d, double factor, bool round_up = false) {
+        if (factor == 1) {
+            return d;
+        }
+        auto const scaled = static_cast<double>(d.count()) * factor;
+        return duration(static_cast<rep>(round_up ? std::ceil(scaled) : scaled));
+    }
+
+    static inline double speedup_ = 1;
+    static inline std::chrono::steady_clock::time_point const epoch_ = std::chrono::steady_clock::now();
+};
+
+// The Simulated-Time value for a response scheduled to take `scheduled` of
+// virtual time, e.g. "dur=5000;speedup=100".
+inline std::string simulated_time_value(std::chrono::milliseconds scheduled) {
+    char speedup[32];
+    auto const [end, ec] = std::to_chars(speedup, speedup + sizeof(speedup), virtual_clock::speedup());
+    std::string value = "dur=" + std::to_string(scheduled.count()) + ";speedup=";
+    value.append(speedup, ec == std::errc() ? end : speedup);
+    return value;
+}